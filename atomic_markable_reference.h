@@ -1,5 +1,11 @@
+#ifndef ATOMIC_MARKABLE_REFERENCE_H
+#define ATOMIC_MARKABLE_REFERENCE_H
+
 #include <atomic>
 
+// Loads default to acquire and stores to release: a node is fully initialized before the
+// release that links it, and readers that acquire the link see it. CAS is acq_rel.
+// Pass seq_cst explicitly where a store-load order is needed (hazard validation).
 template<class V> class AtomicMarkableReference {
 private:
     static const uintptr_t mask = 1;
@@ -8,38 +14,47 @@ public:
     AtomicMarkableReference() = default;
 
     AtomicMarkableReference(V* ref, bool mark) {
-        val.store(convert(ref, mark));
+        val.store(convert(ref, mark), std::memory_order_relaxed);
     }
 
-    V* getRef() {
-        return (V*)(val.load() & ~mask);
+    V* getRef(std::memory_order order = std::memory_order_acquire) {
+        return (V*)(val.load(order) & ~mask);
     }
 
-    bool getMark() {
-        return static_cast<bool>(val.load() & mask);
+    bool getMark(std::memory_order order = std::memory_order_acquire) {
+        return static_cast<bool>(val.load(order) & mask);
     }
 
-    uintptr_t getVal() {
-        return val.load();
+    uintptr_t getVal(std::memory_order order = std::memory_order_acquire) {
+        return val.load(order);
     }
 
-    V* getRefAndMark(bool& mark) {
-        uintptr_t _val = val.load();
+    V* getRefAndMark(bool& mark, std::memory_order order = std::memory_order_acquire) {
+        uintptr_t _val = val.load(order);
         mark = static_cast<bool>(_val & mask);
         return (V*)(_val & ~mask);
     }
 
-    void setVal(V* ref, bool mark) {
-        val.store(convert(ref, mark));
+    void setVal(V* ref, bool mark, std::memory_order order = std::memory_order_release) {
+        val.store(convert(ref, mark), order);
     }
 
     bool CAS(uintptr_t& expected, V* newRef, bool newMark) {
-        return val.compare_exchange_strong(expected, convert(newRef, newMark));
+        return val.compare_exchange_strong(expected, convert(newRef, newMark),
+                                           std::memory_order_acq_rel, std::memory_order_acquire);
     }
 
     bool CAS(V* expRef, V* newRef, bool expMark, bool newMark) {
         uintptr_t _val = convert(expRef, expMark);
-        return val.compare_exchange_strong(_val, convert(newRef, newMark));
+        return val.compare_exchange_strong(_val, convert(newRef, newMark),
+                                           std::memory_order_acq_rel, std::memory_order_acquire);
+    }
+
+    // May fail spuriously, use only where a failure just re-reads and retries
+    bool weakCAS(V* expRef, V* newRef, bool expMark, bool newMark) {
+        uintptr_t _val = convert(expRef, expMark);
+        return val.compare_exchange_weak(_val, convert(newRef, newMark),
+                                         std::memory_order_acq_rel, std::memory_order_acquire);
     }
 
     static uintptr_t convert(V* ref, bool mark) {
@@ -50,3 +65,5 @@ public:
         return val.is_lock_free();
     }
 };
+
+#endif //ATOMIC_MARKABLE_REFERENCE_H
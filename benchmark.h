@@ -0,0 +1,335 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "skiplist_stats.h"
+
+// Throughput and latency harness for the set benchmarks. Keys and operations are generated
+// before the clock starts, all threads are released together by a start barrier, and every
+// operation is timed with steady_clock into a per-thread latency histogram.
+
+enum class KeyDistribution {
+    uniform,
+    zipfian,
+    sequential
+};
+
+inline const char* toString(KeyDistribution distribution) {
+    switch (distribution) {
+        case KeyDistribution::uniform: return "uniform";
+        case KeyDistribution::zipfian: return "zipfian";
+        default: return "sequential";
+    }
+}
+
+struct BenchmarkConfig {
+    std::string name;
+    KeyDistribution distribution = KeyDistribution::uniform;
+    unsigned int numOfThreads = 1;
+    int numOfOperations = 100000;   // per thread
+    int keyRange = 100000;          // keys are in [0, keyRange), every other one is present at start
+    double containsRatio = 0.9;
+    double addRatio = 0.05;         // the rest are removes
+    double zipfTheta = 0.99;
+    double P = 0.5;
+    unsigned int maxHeight = 20;
+    uint64_t seed = 1;
+};
+
+// Log-linear latency histogram in nanoseconds: exact below 64 ns, then 32 buckets per power
+// of two, so a reported percentile is within about 3% of the true value.
+class LatencyHistogram {
+    static const unsigned int numOfLinear = 64;
+    static const unsigned int subBucketBits = 5;
+    static const unsigned int numOfBuckets = numOfLinear + (64 - 6) * (1u << subBucketBits);
+
+    std::vector<uint64_t> counts;
+    uint64_t numOfSamples;
+
+public:
+    LatencyHistogram() : counts(numOfBuckets, 0), numOfSamples(0) {}
+
+    void record(uint64_t ns) {
+        ++counts[bucketOf(ns)];
+        ++numOfSamples;
+    }
+
+    void merge(const LatencyHistogram& other) {
+        for (unsigned int i = 0; i < numOfBuckets; ++i) {
+            counts[i] += other.counts[i];
+        }
+        numOfSamples += other.numOfSamples;
+    }
+
+    // lower bound of the bucket holding the q-quantile
+    uint64_t percentile(double q) const {
+        if(numOfSamples == 0) {
+            return 0;
+        }
+        uint64_t rank = (uint64_t)std::ceil(q * numOfSamples);
+        uint64_t seen = 0;
+        for (unsigned int i = 0; i < numOfBuckets; ++i) {
+            seen += counts[i];
+            if(seen >= rank && counts[i] > 0) {
+                return lowerBoundOf(i);
+            }
+        }
+        return lowerBoundOf(numOfBuckets - 1);
+    }
+
+private:
+    static unsigned int bucketOf(uint64_t ns) {
+        if(ns < numOfLinear) {
+            return (unsigned int)ns;
+        }
+        unsigned int exponent = 63;
+        while (!(ns >> exponent)) {
+            --exponent;
+        }
+        unsigned int subBucket = (unsigned int)(ns >> (exponent - subBucketBits)) & ((1u << subBucketBits) - 1);
+        return numOfLinear + (exponent - 6) * (1u << subBucketBits) + subBucket;
+    }
+
+    static uint64_t lowerBoundOf(unsigned int bucket) {
+        if(bucket < numOfLinear) {
+            return bucket;
+        }
+        unsigned int exponent = (bucket - numOfLinear) / (1u << subBucketBits) + 6;
+        uint64_t subBucket = (bucket - numOfLinear) % (1u << subBucketBits);
+        return (1ull << exponent) + (subBucket << (exponent - subBucketBits));
+    }
+};
+
+// Zipfian ranks in [0, n) after Gray et al., "Quickly generating billion-record synthetic
+// databases", the same generator YCSB uses. Ranks are scrambled over the key range so the
+// hot keys don't all sit next to each other.
+class ZipfianGenerator {
+    uint64_t n;
+    double theta;
+    double alpha;
+    double zetaN;
+    double eta;
+
+public:
+    ZipfianGenerator(uint64_t n, double theta) {
+        this->n = n;
+        this->theta = theta;
+        alpha = 1.0 / (1.0 - theta);
+        zetaN = zeta(n, theta);
+        eta = (1.0 - std::pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta(2, theta) / zetaN);
+    }
+
+    template <class G> uint64_t next(G& generator) const {
+        double u = std::uniform_real_distribution<double>(0.0, 1.0)(generator);
+        double uz = u * zetaN;
+        uint64_t rank;
+        if(uz < 1.0) {
+            rank = 0;
+        } else if(uz < 1.0 + std::pow(0.5, theta)) {
+            rank = 1;
+        } else {
+            rank = (uint64_t)(n * std::pow(eta * u - eta + 1.0, alpha));
+        }
+        rank = rank < n ? rank : n - 1;
+        return (rank * 0x9E3779B97F4A7C15ull >> 17) % n;
+    }
+
+private:
+    static double zeta(uint64_t n, double theta) {
+        double sum = 0.0;
+        for (uint64_t i = 1; i <= n; ++i) {
+            sum += 1.0 / std::pow((double)i, theta);
+        }
+        return sum;
+    }
+};
+
+#ifdef SKIPLIST_STATS
+// prints list.stats() for the structures that have it
+template <class List> auto printStats(List& list, std::ostream& out, int) -> decltype(list.stats(), void()) {
+    list.stats().print(out);
+}
+
+template <class List> void printStats(List& list, std::ostream& out, long) {}
+#endif
+
+struct BenchmarkResult {
+    BenchmarkConfig config;
+    double seconds;
+    double opsPerSecond;
+    std::vector<double> threadOpsPerSecond;
+    uint64_t p50;
+    uint64_t p99;
+    uint64_t p999;
+};
+
+enum class OperationType : unsigned char {
+    contains,
+    add,
+    remove
+};
+
+struct Operation {
+    int key;
+    OperationType type;
+};
+
+// zipfian is shared by the threads of a config, its zeta takes O(keyRange) to compute
+inline std::vector<Operation> generateOperations(const BenchmarkConfig& config, unsigned int thread, const ZipfianGenerator* zipfian) {
+    std::mt19937_64 generator(config.seed * 1000003 + thread);
+    std::uniform_real_distribution<double> decision(0.0, 1.0);
+    std::uniform_int_distribution<int> uniform(0, config.keyRange - 1);
+
+    std::vector<Operation> operations(config.numOfOperations);
+    for (int i = 0; i < config.numOfOperations; ++i) {
+        switch (config.distribution) {
+            case KeyDistribution::uniform:
+                operations[i].key = uniform(generator);
+                break;
+            case KeyDistribution::zipfian:
+                operations[i].key = (int)zipfian->next(generator);
+                break;
+            case KeyDistribution::sequential:
+                // threads walk the range interleaved, each in ascending order
+                operations[i].key = (int)(((uint64_t)i * config.numOfThreads + thread) % config.keyRange);
+                break;
+        }
+        double d = decision(generator);
+        operations[i].type = d < config.containsRatio ? OperationType::contains
+                             : d < config.containsRatio + config.addRatio ? OperationType::add
+                             : OperationType::remove;
+    }
+    return operations;
+}
+
+template <class List> BenchmarkResult runBenchmark(const BenchmarkConfig& config) {
+    typedef std::chrono::steady_clock Clock;
+
+    List list(config.maxHeight, config.numOfThreads, config.P);
+    std::vector<int> initial;
+    for (int key = 0; key < config.keyRange; key += 2) {
+        initial.push_back(key);
+    }
+    list.insertBatch(initial.begin(), initial.end());
+
+    ZipfianGenerator* zipfian = nullptr;
+    if(config.distribution == KeyDistribution::zipfian) {
+        zipfian = new ZipfianGenerator(config.keyRange, config.zipfTheta);
+    }
+    std::vector<std::vector<Operation>> operations(config.numOfThreads);
+    for (unsigned int i = 0; i < config.numOfThreads; ++i) {
+        operations[i] = generateOperations(config, i, zipfian);
+    }
+    delete zipfian;
+
+    std::vector<LatencyHistogram> histograms(config.numOfThreads);
+    std::vector<Clock::time_point> ends(config.numOfThreads);
+    std::atomic<unsigned int> numOfReady{0};
+    std::atomic<bool> go{false};
+    std::vector<std::thread> threads;
+    for (unsigned int i = 0; i < config.numOfThreads; ++i) {
+        threads.emplace_back([&, i] {
+            const std::vector<Operation>& ops = operations[i];
+            LatencyHistogram& histogram = histograms[i];
+            numOfReady.fetch_add(1, std::memory_order_acq_rel);
+            while (!go.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            for (const Operation& op : ops) {
+                Clock::time_point start = Clock::now();
+                switch (op.type) {
+                    case OperationType::contains:
+                        list.contains(op.key);
+                        break;
+                    case OperationType::add:
+                        list.add(op.key);
+                        break;
+                    case OperationType::remove:
+                        list.remove(op.key);
+                        break;
+                }
+                histogram.record((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+            }
+            ends[i] = Clock::now();
+        });
+    }
+    while (numOfReady.load(std::memory_order_acquire) < config.numOfThreads) {
+        std::this_thread::yield();
+    }
+    Clock::time_point start = Clock::now();
+    go.store(true, std::memory_order_release);
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    SKIPLIST_STAT(printStats(list, std::cout, 0));
+
+    BenchmarkResult result;
+    result.config = config;
+    Clock::time_point end = start;
+    LatencyHistogram total;
+    for (unsigned int i = 0; i < config.numOfThreads; ++i) {
+        double seconds = std::chrono::duration<double>(ends[i] - start).count();
+        result.threadOpsPerSecond.push_back(config.numOfOperations / seconds);
+        end = ends[i] > end ? ends[i] : end;
+        total.merge(histograms[i]);
+    }
+    result.seconds = std::chrono::duration<double>(end - start).count();
+    result.opsPerSecond = (double)config.numOfOperations * config.numOfThreads / result.seconds;
+    result.p50 = total.percentile(0.5);
+    result.p99 = total.percentile(0.99);
+    result.p999 = total.percentile(0.999);
+    return result;
+}
+
+inline void writeCsvHeader(std::ostream& out) {
+    out << "name,distribution,threads,operations,keyRange,P,maxHeight,contains,add,remove,seconds,opsPerSecond,"
+           "minThreadOpsPerSecond,maxThreadOpsPerSecond,p50Ns,p99Ns,p999Ns" << std::endl;
+}
+
+inline void writeCsv(std::ostream& out, const BenchmarkResult& result) {
+    const BenchmarkConfig& config = result.config;
+    double minOps = result.threadOpsPerSecond[0];
+    double maxOps = result.threadOpsPerSecond[0];
+    for (double ops : result.threadOpsPerSecond) {
+        minOps = ops < minOps ? ops : minOps;
+        maxOps = ops > maxOps ? ops : maxOps;
+    }
+    out << config.name << ',' << toString(config.distribution) << ',' << config.numOfThreads << ','
+        << config.numOfOperations << ',' << config.keyRange << ',' << config.P << ',' << config.maxHeight << ','
+        << config.containsRatio << ',' << config.addRatio << ',' << 1.0 - config.containsRatio - config.addRatio << ','
+        << result.seconds << ',' << result.opsPerSecond << ',' << minOps << ',' << maxOps << ','
+        << result.p50 << ',' << result.p99 << ',' << result.p999 << std::endl;
+}
+
+// one JSON object per result, write them between "[" and "]"
+inline void writeJson(std::ostream& out, const BenchmarkResult& result, bool isFirst) {
+    const BenchmarkConfig& config = result.config;
+    out << (isFirst ? "  {" : ",\n  {")
+        << "\"name\": \"" << config.name << "\", "
+        << "\"distribution\": \"" << toString(config.distribution) << "\", "
+        << "\"threads\": " << config.numOfThreads << ", "
+        << "\"operations\": " << config.numOfOperations << ", "
+        << "\"keyRange\": " << config.keyRange << ", "
+        << "\"P\": " << config.P << ", "
+        << "\"maxHeight\": " << config.maxHeight << ", "
+        << "\"mix\": [" << config.containsRatio << ", " << config.addRatio << ", "
+        << 1.0 - config.containsRatio - config.addRatio << "], "
+        << "\"seconds\": " << result.seconds << ", "
+        << "\"opsPerSecond\": " << result.opsPerSecond << ", "
+        << "\"threadOpsPerSecond\": [";
+    for (unsigned int i = 0; i < result.threadOpsPerSecond.size(); ++i) {
+        out << (i == 0 ? "" : ", ") << result.threadOpsPerSecond[i];
+    }
+    out << "], "
+        << "\"latencyNs\": {\"p50\": " << result.p50 << ", \"p99\": " << result.p99 << ", \"p999\": " << result.p999 << "}}";
+}
+
+#endif //BENCHMARK_H
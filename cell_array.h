@@ -0,0 +1,182 @@
+#ifndef CELL_ARRAY_H
+#define CELL_ARRAY_H
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <thread>
+
+// Fixed instead of std::hardware_destructive_interference_size, which may change with
+// compiler flags and would change the layout of the cells with it.
+static const std::size_t cacheLineSize = 64;
+
+// Growable array of per-thread cells for the reclamation domains. Cells never move:
+// segment 0 holds the first baseSize cells and segment k > 0 the range
+// [baseSize << (k-1), baseSize << k), so the array doubles with every segment.
+// Growth appends one segment with a CAS and never blocks readers.
+// A segment is one cache-line-aligned block and every cell starts on its own line, cells may
+// be bigger than sizeof(C) when they end with an inline array (cellSize).
+template <class C> class CellArray {
+    static const unsigned int maxNumOfSegments = 32;
+
+    unsigned int baseShift;
+    std::size_t cellStride;
+    std::atomic<char*> segments[maxNumOfSegments];
+    std::atomic<unsigned int> numOfCells;
+
+public:
+    // initCell(void* memory) constructs a cell in place
+    template <class F> CellArray(unsigned int minNumOfCells, std::size_t cellSize, F initCell) {
+        baseShift = 0;
+        while ((1u << baseShift) < minNumOfCells) {
+            ++baseShift;
+        }
+        cellStride = (cellSize + cacheLineSize - 1) / cacheLineSize * cacheLineSize;
+        for (unsigned int i = 0; i < maxNumOfSegments; ++i) {
+            segments[i].store(nullptr, std::memory_order_relaxed);
+        }
+        segments[0].store(makeSegment(0, initCell), std::memory_order_relaxed);
+        numOfCells.store(1u << baseShift, std::memory_order_relaxed);
+    }
+
+    template <class F> CellArray(unsigned int minNumOfCells, F initCell) : CellArray(minNumOfCells, sizeof(C), initCell) {}
+
+    ~CellArray() {
+        for (unsigned int k = 0; k < maxNumOfSegments; ++k) {
+            char* segment = segments[k].load(std::memory_order_relaxed);
+            if(segment != nullptr) {
+                freeSegment(k, segment);
+            }
+        }
+    }
+
+    unsigned int size() const {
+        return numOfCells.load(std::memory_order_acquire);
+    }
+
+    C* get(unsigned int i) const {
+        unsigned int k = segmentOf(i);
+        unsigned int first = k == 0 ? 0 : (1u << (baseShift + k - 1));
+        return reinterpret_cast<C*>(segments[k].load(std::memory_order_acquire) + (i - first)*cellStride);
+    }
+
+    // Appends a segment unless someone already grew the array past seenSize.
+    // Returns false only when the array can't grow any more.
+    template <class F> bool grow(unsigned int seenSize, F initCell) {
+        unsigned int k = segmentOf(seenSize);
+        if(k >= maxNumOfSegments) {
+            return false;
+        }
+        if(segments[k].load(std::memory_order_acquire) == nullptr) {
+            char* segment = makeSegment(k, initCell);
+            char* expected = nullptr;
+            if(!segments[k].compare_exchange_strong(expected, segment, std::memory_order_acq_rel)) {
+                freeSegment(k, segment);
+            }
+        }
+        unsigned int grown = 1u << (baseShift + k);
+        numOfCells.compare_exchange_strong(seenSize, grown, std::memory_order_acq_rel);
+        return true;
+    }
+
+private:
+    unsigned int segmentOf(unsigned int i) const {
+        unsigned int q = i >> baseShift;
+        if(q == 0) {
+            return 0;
+        }
+#if defined(__GNUC__) || defined(__clang__)
+        return 32 - (unsigned int)__builtin_clz(q);
+#else
+        unsigned int k = 1;
+        while (q >>= 1) {
+            ++k;
+        }
+        return k;
+#endif
+    }
+
+    unsigned int segmentSize(unsigned int k) const {
+        return k == 0 ? (1u << baseShift) : (1u << (baseShift + k - 1));
+    }
+
+    template <class F> char* makeSegment(unsigned int k, F initCell) {
+        char* segment = static_cast<char*>(::operator new(segmentSize(k)*cellStride, std::align_val_t(cacheLineSize)));
+        for (unsigned int i = 0; i < segmentSize(k); ++i) {
+            initCell(segment + i*cellStride);
+        }
+        return segment;
+    }
+
+    void freeSegment(unsigned int k, char* segment) {
+        for (unsigned int i = 0; i < segmentSize(k); ++i) {
+            reinterpret_cast<C*>(segment + i*cellStride)->~C();
+        }
+        ::operator delete(segment, std::align_val_t(cacheLineSize));
+    }
+};
+
+// Cells bound to the current thread by attachThread(), at most one per domain.
+// A bound cell is handed out by acquireCell() while it is not already in use by the
+// same thread, nested acquisitions (an iterator plus an operation) get a fresh cell.
+class ThreadBindings {
+public:
+    struct Binding {
+        const void* domain;
+        int cellIndex;
+        unsigned int numOfAttaches;
+        bool isInUse;
+    };
+
+private:
+    static const unsigned int maxNumOfBindings = 16;
+
+    Binding bindings[maxNumOfBindings];
+    unsigned int numOfBindings = 0;
+
+public:
+    static ThreadBindings& local() {
+        static thread_local ThreadBindings threadBindings;
+        return threadBindings;
+    }
+
+    Binding* find(const void* domain) {
+        for (unsigned int i = 0; i < numOfBindings; ++i) {
+            if(bindings[i].domain == domain) {
+                return &bindings[i];
+            }
+        }
+        return nullptr;
+    }
+
+    Binding* add(const void* domain, int cellIndex) {
+        if(numOfBindings == maxNumOfBindings) {
+            return nullptr;
+        }
+        bindings[numOfBindings] = Binding{domain, cellIndex, 1, false};
+        return &bindings[numOfBindings++];
+    }
+
+    void remove(const void* domain) {
+        for (unsigned int i = 0; i < numOfBindings; ++i) {
+            if(bindings[i].domain == domain) {
+                bindings[i] = bindings[--numOfBindings];
+                return;
+            }
+        }
+    }
+
+    bool isEmpty() const {
+        return numOfBindings == 0;
+    }
+
+    // a per-thread starting point, so threads don't all race for cell 0
+    static unsigned int hint() {
+        static thread_local unsigned int threadHint =
+                (unsigned int)std::hash<std::thread::id>()(std::this_thread::get_id());
+        return threadHint;
+    }
+};
+
+#endif //CELL_ARRAY_H
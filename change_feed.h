@@ -0,0 +1,199 @@
+#ifndef CHANGE_FEED_H
+#define CHANGE_FEED_H
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <vector>
+#include <unistd.h>
+#include "cell_array.h"
+
+// Log of the keys a skip list adds and removes, fed at the linearization points. Every change
+// gets a sequence number reserved right before its CAS, so if one change depends on another
+// (a remove of a key that an add linked, an add after the remove) it also gets a higher
+// number. A failed CAS leaves a gap. Each cell pushes its changes into a ring of its own
+// without locks; the one consumer merges the rings and hands out changes in sequence order,
+// but only those below the watermark, the smallest number that may still be in flight.
+// A full ring never makes its producer wait: the change is dropped and counted instead, and
+// a consumer that sees getNumOfDropped() grow has lost changes and must resync from the list.
+template <class T> class ChangeFeed {
+public:
+    enum Op : unsigned char {
+        added,
+        removed
+    };
+
+    struct Change {
+        unsigned long long seq;
+        Op op;
+        T key;
+    };
+
+    // bytes per change written by drainTo(): seq, op, then the key bytes
+    static const unsigned int recordSize = sizeof(unsigned long long) + 1 + sizeof(T);
+
+private:
+    static const unsigned long long noneInFlight = ~0ull;
+
+    // One producer (the thread holding the cell) and the consumer
+    struct Ring {
+        alignas(cacheLineSize) std::atomic<unsigned long long> numOfPushed{0};
+        // a lower bound of the seq reserved for the change in flight, noneInFlight if none is
+        std::atomic<unsigned long long> inFlight{noneInFlight};
+        // changes that found the ring full
+        std::atomic<unsigned long long> numOfDropped{0};
+        alignas(cacheLineSize) std::atomic<unsigned long long> numOfPopped{0};
+        Change* changes;
+
+        explicit Ring(unsigned int capacity) {
+            changes = static_cast<Change*>(::operator new(capacity * sizeof(Change)));
+        }
+
+        ~Ring() {
+            ::operator delete(changes);
+        }
+    };
+
+    unsigned int capacity;
+    std::atomic<unsigned long long> nextSeq{0};
+    CellArray<Ring>* rings;
+    // drained from the rings, not below the watermark yet; consumer only
+    std::vector<Change> pending;
+
+public:
+    // ringCapacity is rounded up to a power of two
+    ChangeFeed(unsigned int minNumOfCells, unsigned int ringCapacity) {
+        capacity = 1;
+        while (capacity < ringCapacity) {
+            capacity <<= 1;
+        }
+        unsigned int ringSize = capacity;
+        rings = new CellArray<Ring>(minNumOfCells, [ringSize](void* memory) { new (memory) Ring(ringSize); });
+    }
+
+    ChangeFeed(const ChangeFeed&) = delete;
+    ChangeFeed& operator=(const ChangeFeed&) = delete;
+
+    ~ChangeFeed() {
+        for (unsigned int i = 0; i < rings->size(); ++i) {
+            Ring* ring = rings->get(i);
+            for (unsigned long long j = ring->numOfPopped; j < ring->numOfPushed; ++j) {
+                ring->changes[j & (capacity - 1)].~Change();
+            }
+        }
+        delete rings;
+    }
+
+    // Called by the thread holding the cell right before the CAS of a change. The lower bound
+    // is announced before the number is taken: a consumer that misses the announcement has
+    // read nextSeq before it, so its watermark is no higher than the number.
+    unsigned long long reserve(int cellIndex) {
+        Ring& ring = ringOf(cellIndex);
+        ring.inFlight.store(nextSeq.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+        return nextSeq.fetch_add(1, std::memory_order_seq_cst);
+    }
+
+    // After the CAS failed
+    void cancel(int cellIndex) {
+        rings->get(cellIndex)->inFlight.store(noneInFlight, std::memory_order_release);
+    }
+
+    // After the CAS succeeded. The dropped count is raised before the number is released, so
+    // a consumer whose watermark has passed a dropped change also sees the count.
+    void publish(int cellIndex, unsigned long long seq, Op op, const T& key) {
+        Ring& ring = *rings->get(cellIndex);
+        unsigned long long pushed = ring.numOfPushed.load(std::memory_order_relaxed);
+        if(pushed - ring.numOfPopped.load(std::memory_order_acquire) == capacity) {
+            ring.numOfDropped.store(ring.numOfDropped.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        } else {
+            new (&ring.changes[pushed & (capacity - 1)]) Change{seq, op, key};
+            ring.numOfPushed.store(pushed + 1, std::memory_order_release);
+        }
+        ring.inFlight.store(noneInFlight, std::memory_order_release);
+    }
+
+    // Changes lost to full rings so far. Read it after a drain(): if it grew since the last
+    // read, the changes handed out may miss some and the consumer has to resync.
+    unsigned long long getNumOfDropped() {
+        unsigned long long result = 0;
+        for (unsigned int i = 0; i < rings->size(); ++i) {
+            result += rings->get(i)->numOfDropped.load(std::memory_order_acquire);
+        }
+        return result;
+    }
+
+    // Appends the changes below the watermark to out in sequence order and returns how many
+    // there were. One consumer thread at a time.
+    std::size_t drain(std::vector<Change>& out) {
+        unsigned long long watermark = nextSeq.load(std::memory_order_seq_cst);
+        unsigned int numOfRings = rings->size();
+        for (unsigned int i = 0; i < numOfRings; ++i) {
+            watermark = std::min(watermark, rings->get(i)->inFlight.load(std::memory_order_seq_cst));
+        }
+        for (unsigned int i = 0; i < numOfRings; ++i) {
+            Ring* ring = rings->get(i);
+            unsigned long long popped = ring->numOfPopped.load(std::memory_order_relaxed);
+            unsigned long long pushed = ring->numOfPushed.load(std::memory_order_acquire);
+            for (; popped < pushed; ++popped) {
+                Change& change = ring->changes[popped & (capacity - 1)];
+                pending.push_back(std::move(change));
+                change.~Change();
+            }
+            ring->numOfPopped.store(popped, std::memory_order_release);
+        }
+        std::sort(pending.begin(), pending.end(), [](const Change& a, const Change& b) { return a.seq < b.seq; });
+        std::size_t n = 0;
+        while (n < pending.size() && pending[n].seq < watermark) {
+            out.push_back(std::move(pending[n]));
+            ++n;
+        }
+        pending.erase(pending.begin(), pending.begin() + n);
+        return n;
+    }
+
+    // drain() into fd, a file or a socket, as recordSize-byte records. Returns the number of
+    // changes written or -1 on an error. The changes not fully written are kept for the next
+    // call then, which should go to a fresh fd: the old one may end with part of a record.
+    long long drainTo(int fd) {
+        static_assert(std::is_trivially_copyable<T>::value, "changes are written as raw key bytes");
+        std::vector<Change> changes;
+        drain(changes);
+        std::vector<char> bytes(changes.size() * recordSize);
+        for (std::size_t i = 0; i < changes.size(); ++i) {
+            char* record = bytes.data() + i * recordSize;
+            std::memcpy(record, &changes[i].seq, sizeof(unsigned long long));
+            record[sizeof(unsigned long long)] = (char)changes[i].op;
+            std::memcpy(record + sizeof(unsigned long long) + 1, &changes[i].key, sizeof(T));
+        }
+        std::size_t numOfWritten = 0;
+        while (numOfWritten < bytes.size()) {
+            ssize_t n = write(fd, bytes.data() + numOfWritten, bytes.size() - numOfWritten);
+            if(n < 0 && errno == EINTR) {
+                continue;
+            }
+            if(n <= 0) {
+                pending.insert(pending.begin(), changes.begin() + numOfWritten / recordSize, changes.end());
+                return -1;
+            }
+            numOfWritten += n;
+        }
+        return (long long)changes.size();
+    }
+
+private:
+    Ring& ringOf(int cellIndex) {
+        unsigned int size;
+        while ((size = rings->size()) <= (unsigned int)cellIndex) {
+            rings->grow(size, [this](void* memory) { new (memory) Ring(capacity); });
+            // a consumer that read nextSeq after this RMW also sees the new ring, and one that
+            // read it before gets a watermark no higher than anything reserved from here on
+            nextSeq.fetch_add(0, std::memory_order_seq_cst);
+        }
+        return *rings->get(cellIndex);
+    }
+};
+
+#endif //CHANGE_FEED_H
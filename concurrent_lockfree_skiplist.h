@@ -1,158 +1,1177 @@
+#ifndef CONCURRENT_LOCKFREE_SKIPLIST_H
+#define CONCURRENT_LOCKFREE_SKIPLIST_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <functional>
 #include <iostream>
-#include <random>
+#include <iterator>
+#include <limits>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
 #include "atomic_markable_reference.h"
+#include "change_feed.h"
+#include "epoch_domain.h"
 #include "hazard_domain.h"
+#include "level_generator.h"
+#include "node_pool.h"
+#include "skiplist_stats.h"
+#include "snapshot_file.h"
+#include "top_level_mirror.h"
+
+// Payload of a map node. Sets (V = void) carry nothing.
+template <class V> class MappedValue {
+public:
+    // bytes of a snapshot record after the key
+    static const unsigned int numOfBytes = sizeof(V);
+
+    std::atomic<V> mapped;
+
+    MappedValue() : mapped(V()) {}
+
+    explicit MappedValue(V mapped) : mapped(mapped) {}
+
+    void saveTo(char* bytes) const {
+        V v = mapped.load(std::memory_order_acquire);
+        std::memcpy(bytes, &v, sizeof(V));
+    }
+
+    void loadFrom(const char* bytes) {
+        V v;
+        std::memcpy(&v, bytes, sizeof(V));
+        mapped.store(v, std::memory_order_relaxed);
+    }
+};
+
+template <> class MappedValue<void> {
+public:
+    static const unsigned int numOfBytes = 0;
+
+    void saveTo(char* bytes) const {}
+
+    void loadFrom(const char* bytes) {}
+};
+
+// Deadline of a node in Clock ticks. Lists without a Clock (void) carry nothing and none of
+// their keys ever expires.
+template <class Clock> class ExpiryTime {
+public:
+    typedef typename Clock::rep Ticks;
+
+    static const bool isExpiring = true;
+    static const Ticks never = std::numeric_limits<Ticks>::max();
+    // what claimExpired() leaves in a passed deadline, below any real one
+    static const Ticks claimed = std::numeric_limits<Ticks>::min();
+    // bytes of a snapshot record after the mapped value
+    static const unsigned int numOfExpiryBytes = sizeof(Ticks);
+
+    std::atomic<Ticks> expiresAt{never};
+
+    static Ticks now() {
+        return Clock::now().time_since_epoch().count();
+    }
+
+    template <class D> static Ticks after(D ttl) {
+        return now() + std::chrono::duration_cast<typename Clock::duration>(ttl).count();
+    }
+
+    // For a node whose deadline is still never
+    void expireAt(Ticks deadline) {
+        expiresAt.store(deadline, std::memory_order_relaxed);
+    }
+
+    // Whether the deadline has passed by now. A passed deadline is replaced with claimed first,
+    // so extend() can't revive the key once anyone has seen it expired.
+    bool claimExpired(Ticks now) {
+        Ticks deadline = expiresAt.load(std::memory_order_relaxed);
+        while (deadline != claimed && deadline <= now) {
+            if(expiresAt.compare_exchange_weak(deadline, claimed, std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return deadline <= now;
+    }
+
+    // Reads the clock only for keys that have a deadline
+    bool claimExpired() {
+        return expiresAt.load(std::memory_order_relaxed) != never && claimExpired(now());
+    }
+
+    // Moves a deadline that hasn't passed by now to deadline
+    bool extend(Ticks now, Ticks deadline) {
+        Ticks old = expiresAt.load(std::memory_order_relaxed);
+        while (old > now) {
+            if(expiresAt.compare_exchange_weak(old, deadline, std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Snapshots keep the time left rather than the deadline, a clock like steady_clock starts
+    // over when the machine does
+    void saveExpiryTo(char* bytes, Ticks now) const {
+        Ticks deadline = expiresAt.load(std::memory_order_relaxed);
+        Ticks left = deadline == never ? never : (deadline > now ? deadline - now : 0);
+        std::memcpy(bytes, &left, sizeof(Ticks));
+    }
+
+    void loadExpiryFrom(const char* bytes, Ticks now) {
+        Ticks left;
+        std::memcpy(&left, bytes, sizeof(Ticks));
+        expiresAt.store(left == never || (now > 0 && left > never - now) ? never : now + left, std::memory_order_relaxed);
+    }
+};
 
-template <class T> class ConcurrentSkipList {
-    template <class E> class Node {
+template <> class ExpiryTime<void> {
+public:
+    typedef long long Ticks;
+
+    static const bool isExpiring = false;
+    static const Ticks never = std::numeric_limits<Ticks>::max();
+    static const unsigned int numOfExpiryBytes = 0;
+
+    static Ticks now() {
+        return 0;
+    }
+
+    void expireAt(Ticks deadline) {}
+
+    void saveExpiryTo(char* bytes, Ticks now) const {}
+
+    void loadExpiryFrom(const char* bytes, Ticks now) {}
+
+    bool claimExpired(Ticks now) {
+        return false;
+    }
+
+    bool claimExpired() {
+        return false;
+    }
+};
+
+// Comparators that define is_transparent, such as std::less<>, can compare T with other key
+// types, lookups then take any of those without building a T
+template <class C, class = void> struct IsTransparent : std::false_type {};
+
+template <class C> struct IsTransparent<C, std::void_t<typename C::is_transparent>> : std::true_type {};
+
+// Reclaimer is the memory reclamation policy: HazardDomain (hazard pointers, bounded garbage)
+// or EpochDomain (one epoch announcement per operation, cheaper traversals).
+// Compare orders the keys: a less-than predicate like std::less<T>, or a three-way one returning
+// an int that is negative, zero or positive.
+// Clock, e.g. std::chrono::steady_clock, lets keys expire, see add(value, ttl).
+template <class T, template <class, class> class Reclaimer = HazardDomain, class V = void, class Compare = std::less<T>,
+          class Clock = void>
+class ConcurrentSkipList {
+protected:
+    // A node and its tower are one pooled block: nexts[] runs past the end of the object
+    // and has level+1 entries. Create and destroy nodes only through create()/destroy().
+    template <class E> class Node : public MappedValue<V>, public ExpiryTime<Clock> {
     public:
         E value;
         unsigned int level;
-        AtomicMarkableReference<Node<E>>* nexts;
+        AtomicMarkableReference<Node<E>> nexts[1];
+
+        static Node* create(unsigned int lvl) {
+            return new (allocate(lvl)) Node(lvl);
+        }
+
+        // value is copied or moved into the node
+        template <class U, class... M> static Node* create(U&& value, unsigned int lvl, M... mapped) {
+            return new (allocate(lvl)) Node(std::forward<U>(value), lvl, mapped...);
+        }
+
+        // value is built in the node from args
+        template <class... Args> static Node* emplace(unsigned int lvl, Args&&... args) {
+            return new (allocate(lvl)) Node(std::in_place, lvl, std::forward<Args>(args)...);
+        }
+
+        static void destroy(Node* node) {
+            unsigned int lvl = node->level;
+            node->~Node();
+            NodePool<Node>::deallocate(node, lvl);
+        }
 
+    private:
         explicit Node(unsigned int lvl) {
-            nexts = new AtomicMarkableReference<Node<E>>[lvl+1];
             level = lvl;
+            initTower();
+        }
+
+        template <class U, class... M> Node(U&& value, unsigned int lvl, M... mapped)
+                : MappedValue<V>(mapped...), value(std::forward<U>(value)) {
+            level = lvl;
+            initTower();
         }
 
-        Node(E value, unsigned int lvl) {
-            this->value = value;
-            nexts = new AtomicMarkableReference<Node<E>>[lvl+1];
+        template <class... Args> Node(std::in_place_t, unsigned int lvl, Args&&... args) : value(std::forward<Args>(args)...) {
             level = lvl;
+            initTower();
+        }
+
+        void initTower() {
+            for (unsigned int i = 1; i <= level; ++i) {
+                new (&nexts[i]) AtomicMarkableReference<Node<E>>();
+            }
+        }
+
+        static void* allocate(unsigned int lvl) {
+            return NodePool<Node>::allocate(lvl, sizeof(Node) + lvl*sizeof(AtomicMarkableReference<Node<E>>));
         }
+    };
 
-        ~Node() {
-            delete[] nexts;
+    struct NodeDeleter {
+        void operator()(Node<T>* node) const {
+            Node<T>::destroy(node);
+        }
+    };
+
+    typedef typename ExpiryTime<Clock>::Ticks Ticks;
+
+    // Nodes popped or expired in a cell and not retired yet, see popMin()
+    struct PopBatch {
+        static const unsigned int capacity = 16;
+
+        Node<T>* nodes[capacity];
+        unsigned int count = 0;
+    };
+
+public:
+    static const unsigned int heightLimit = NodePool<Node<T>>::maxNumOfClasses;
+    // every level costs each hazard cell two slots, which releases and scans go through
+    static const unsigned int defaultMaxHeight = 20;
+
+    // towers on the level rank() and select() start from, see rank()
+    static const unsigned int rankSampleSize = 256;
+
+    // keys saveSnapshot() writes per cell acquisition
+    static const unsigned int snapshotChunkSize = 4096;
+
+    // integral keys in their natural order get a SIMD-searchable mirror of an upper level for
+    // contains(), see locate()
+    static const bool isMirrored = std::is_integral<T>::value
+            && (std::is_same<Compare, std::less<T>>::value || std::is_same<Compare, std::less<>>::value);
+
+    // How a search uses the preds/succs it is given, see locate()
+    enum FingerUse {
+        noFingers,
+        eachFinger,     // every level starts from preds[lvl] when that is further right
+        lowestFinger    // starts at the lowest level whose pred and succ bracket the key
+    };
+
+protected:
+    // Lookups take a T, or any key type Compare accepts if it is transparent
+    template <class K> using IfKey = typename std::enable_if<std::is_same<K, T>::value || IsTransparent<Compare>::value>::type;
+
+    // Preds and succs of the last search in a cell whose thread attached with a finger
+    struct Finger {
+        bool isEnabled = false;
+        Node<T>* preds[heightLimit] = {};
+        Node<T>* succs[heightLimit] = {};
+    };
+
+    // Keys added minus keys removed through one cell, by tower level. Only the thread holding
+    // the cell writes them, so a cell may go negative but the sum over cells doesn't stay so.
+    struct SizeCounters {
+        std::atomic<long long> numOfNodes[heightLimit];
+
+        SizeCounters() {
+            for (unsigned int i = 0; i < heightLimit; ++i) {
+                numOfNodes[i].store(0, std::memory_order_relaxed);
+            }
+        }
+
+        void add(unsigned int lvl, long long n) {
+            numOfNodes[lvl].store(numOfNodes[lvl].load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        }
+    };
+
+public:
+    // Weakly consistent forward iterator: it never returns a key twice and sees every key
+    // present for the whole traversal, keys added or removed meanwhile may or may not show up.
+    // The current node stays protected in slot 3 of the iterator's own hazard cell.
+    class Iterator {
+        friend class ConcurrentSkipList;
+
+        ConcurrentSkipList* list;
+        Node<T>* node;
+        int hzCellIndex;
+
+        Iterator(ConcurrentSkipList* list, Node<T>* node, int hzCellIndex) {
+            this->list = list;
+            this->node = node;
+            this->hzCellIndex = hzCellIndex;
+        }
+
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef T value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const T* pointer;
+        typedef const T& reference;
+
+        Iterator(const Iterator& other) {
+            list = other.list;
+            node = other.node;
+            hzCellIndex = -1;
+            if(node != list->tail) {
+                hzCellIndex = list->hazardDomain->acquireCell();
+                list->hazardDomain->protect(node, hzCellIndex, 3);
+            }
+        }
+
+        Iterator& operator=(Iterator other) {
+            std::swap(list, other.list);
+            std::swap(node, other.node);
+            std::swap(hzCellIndex, other.hzCellIndex);
+            return *this;
+        }
+
+        ~Iterator() {
+            if(hzCellIndex >= 0) {
+                list->hazardDomain->releaseCell(hzCellIndex);
+            }
+        }
+
+        reference operator*() const {
+            return node->value;
+        }
+
+        pointer operator->() const {
+            return &node->value;
+        }
+
+        Iterator& operator++() {
+            node = list->next(node, hzCellIndex);
+            if(node == list->tail) {
+                list->hazardDomain->releaseCell(hzCellIndex);
+                hzCellIndex = -1;
+            }
+            return *this;
+        }
+
+        Iterator operator++(int) {
+            Iterator result(*this);
+            ++(*this);
+            return result;
+        }
+
+        bool operator==(const Iterator& other) const {
+            return node == other.node;
+        }
+
+        bool operator!=(const Iterator& other) const {
+            return node != other.node;
+        }
+    };
+
+    // Keeps a reclamation cell bound to the thread that called attach(), so its operations
+    // skip claiming a cell. Must be destroyed by the same thread, before the list and after
+    // the iterators that thread created meanwhile.
+    class ThreadHandle {
+        friend class ConcurrentSkipList;
+
+        ConcurrentSkipList* list;
+        int fingerCellIndex;
+
+        explicit ThreadHandle(ConcurrentSkipList* list) {
+            this->list = list;
+            fingerCellIndex = -1;
+        }
+
+    public:
+        ThreadHandle(ThreadHandle&& other) noexcept {
+            list = other.list;
+            fingerCellIndex = other.fingerCellIndex;
+            other.list = nullptr;
+        }
+
+        ThreadHandle(const ThreadHandle&) = delete;
+        ThreadHandle& operator=(const ThreadHandle&) = delete;
+
+        ~ThreadHandle() {
+            if(list != nullptr) {
+                if(fingerCellIndex >= 0) {
+                    list->fingers->get(fingerCellIndex)->isEnabled = false;
+                }
+                list->hazardDomain->detachThread();
+            }
         }
     };
 
 // FIELDS
-private:
+protected:
     double P;
     unsigned int maxHeight;
+    // highest level any tower has reached, searches start there; it never goes down
+    std::atomic<int> topLevel{0};
+
+    LevelGenerator levelGenerator;
 
-    std::random_device randomDevice;
+    Compare comparator;
 
-    HazardDomain<Node<T>>* hazardDomain;
+    Reclaimer<Node<T>, NodeDeleter>* hazardDomain;
 
     Node<T>* head;
     Node<T>* tail;
 
+    TopLevelMirror<T, Node<T>>* mirror;
+
+    // indexed like the reclamation cells
+    CellArray<SizeCounters>* sizeCounters;
+    CellArray<PopBatch>* popBatches;
+    CellArray<Finger>* fingers;
+    // nullptr until enableChangeFeed()
+    ChangeFeed<T>* changeFeed;
+    // popApproxMin() starts that many levels up and jumps over up to sprayJump nodes per level
+    unsigned int sprayHeight;
+    unsigned int sprayJump;
+    // key expireSome() stopped after, empty to start from the first key
+    std::optional<T> expiryCursor;
+
+#ifdef SKIPLIST_STATS
+    // indexed like the reclamation cells, so only the thread holding a cell writes its counters
+    CellArray<OperationStats>* operationStats;
+#endif
+
 // CONSTRUCTORS
 public:
-    explicit ConcurrentSkipList(unsigned int maxHeight = 20, unsigned int maxNumOfThreads = 8, double P = 0.7) {
-        this->maxHeight = maxHeight;
+    // maxHeight only caps the towers, the list grows its height with the number of keys up to
+    // it, at most heightLimit
+    explicit ConcurrentSkipList(unsigned int maxHeight = defaultMaxHeight, unsigned int maxNumOfThreads = 8, double P = 0.7,
+                                const Compare& comparator = Compare()) : comparator(comparator) {
+        this->maxHeight = maxHeight < heightLimit ? maxHeight : heightLimit;
         this->P = P;
-        tail = new Node<T>(maxHeight-1);
-        head = new Node<T>(maxHeight-1);
-        for(int i = 0; i < maxHeight; ++i) {
+        levelGenerator = LevelGenerator(P, this->maxHeight-1);
+        tail = Node<T>::create(this->maxHeight-1);
+        head = Node<T>::create(this->maxHeight-1);
+        for(int i = 0; i < this->maxHeight; ++i) {
             head->nexts[i].setVal(tail, false);
         }
-        hazardDomain = new HazardDomain<Node<T>>(2*maxHeight+4, maxNumOfThreads);
+        hazardDomain = new Reclaimer<Node<T>, NodeDeleter>(2*this->maxHeight+4, maxNumOfThreads);
+        mirror = isMirrored ? new TopLevelMirror<T, Node<T>>(this->maxHeight-1) : nullptr;
+        changeFeed = nullptr;
+        sizeCounters = new CellArray<SizeCounters>(maxNumOfThreads, [](void* memory) { new (memory) SizeCounters(); });
+        popBatches = new CellArray<PopBatch>(maxNumOfThreads, [](void* memory) { new (memory) PopBatch(); });
+        fingers = new CellArray<Finger>(maxNumOfThreads, [](void* memory) { new (memory) Finger(); });
+        // as in the SprayList, about log_{1/P}(threads) levels and log2(threads) + 1 nodes
+        sprayHeight = maxNumOfThreads > 1 ? (unsigned int)std::ceil(std::log((double)maxNumOfThreads) / std::log(1.0 / P)) : 0;
+        sprayJump = (unsigned int)std::ceil(std::log2((double)(maxNumOfThreads > 1 ? maxNumOfThreads : 1))) + 1;
+        SKIPLIST_STAT(operationStats = new CellArray<OperationStats>(maxNumOfThreads, [](void* memory) { new (memory) OperationStats(); }));
+    }
+
+    // Builds the list from ascending keys in one pass, linking every tower to the last node of
+    // each level. Duplicates are skipped, the input must be sorted.
+    template <class It, class = typename std::iterator_traits<It>::iterator_category>
+    ConcurrentSkipList(It sortedBegin, It sortedEnd, unsigned int maxHeight = defaultMaxHeight, unsigned int maxNumOfThreads = 8, double P = 0.7,
+                       const Compare& comparator = Compare())
+            : ConcurrentSkipList(maxHeight, maxNumOfThreads, P, comparator) {
+        Node<T>* lasts[heightLimit];
+        std::fill(lasts, lasts + this->maxHeight, head);
+        for (It it = sortedBegin; it != sortedEnd; ++it) {
+            if(lasts[0] == head || isLess(lasts[0]->value, *it)) {
+                append(Node<T>::create(*it, getRandomLevel()), lasts, 0);
+            }
+        }
     }
 
 //DESTRUCTOR
     ~ConcurrentSkipList() {
+        for (unsigned int i = 0; i < popBatches->size(); ++i) {
+            int hzCellIndex = hazardDomain->acquireCell();
+            flushPops(*popBatches->get(i), hzCellIndex);
+            hazardDomain->releaseCell(hzCellIndex);
+        }
+        delete popBatches;
+        delete fingers;
+        delete sizeCounters;
         Node<T> *toDel;
         for (Node<T> *p = head; p!=tail;) {
             toDel = p;
             p=p->nexts[0].getRef();
-            delete toDel;
+            Node<T>::destroy(toDel);
         }
-        delete tail;
+        Node<T>::destroy(tail);
         delete hazardDomain;
+        delete mirror;
+        delete changeFeed;
+        SKIPLIST_STAT(delete operationStats);
     }
 
 // PUBLIC METHODS
 public:
-    bool contains(T value) {
-        int botLvl = 0;
-        bool mark;
+    bool contains(const T& value) {
+        return contains<T>(value);
+    }
+
+    template <class K, class = IfKey<K>> bool contains(const K& value) {
+        bool result;
         int hzCellIndex = hazardDomain->acquireCell();
+        Finger* finger = fingerOf(hzCellIndex);
+        if(finger != nullptr) {
+            result = find(value, finger->preds, finger->succs, hzCellIndex, fingerUseOf(*finger, hzCellIndex));
+            if(result && hasExpired(finger->succs[0])) {
+                removeNode(finger->succs[0], finger->preds, finger->succs, hzCellIndex);
+                result = false;
+            }
+        } else {
+            result = search(value, hzCellIndex) != nullptr;
+        }
+        hazardDomain->releaseCell(hzCellIndex);
+        return result;
+    }
 
-        Node<T>* pred = hazardDomain->protect(head, hzCellIndex, 0);
-        Node<T>* curr;
-        Node<T>* succ;
+    // preds[lvl] and succs[lvl] stay protected until the next find() in the same cell
+    template <class K> bool find(const K& value, Node<T>** preds, Node<T>** succs, int hzCellIndex, FingerUse fingerUse = noFingers) {
+        return isEqual(locate(value, preds, succs, hzCellIndex, fingerUse), value);
+    }
+
+    // The key is copied into the new node only if it is absent
+    bool add(const T& value) {
+        return addFrom(value);
+    }
+
+    // The key is moved into the new node, and left as it was if it is present
+    bool add(T&& value) {
+        return addFrom(std::move(value));
+    }
+
+    // add() of a key that expires ttl from now; keys added otherwise never expire. An expired
+    // key is absent for every operation, the first lookup that meets it or expireSome()
+    // removes it. A present key keeps its deadline, see expireAfter().
+    template <class Rep, class Period> bool add(const T& value, std::chrono::duration<Rep, Period> ttl) {
+        static_assert(ExpiryTime<Clock>::isExpiring, "expiring keys need a list with a Clock");
+        return addFrom(value, ExpiryTime<Clock>::after(ttl));
+    }
+
+    // Gives a present key a new deadline ttl from now, returns false if it is absent or expired
+    template <class Rep, class Period> bool expireAfter(const T& value, std::chrono::duration<Rep, Period> ttl) {
+        static_assert(ExpiryTime<Clock>::isExpiring, "expiring keys need a list with a Clock");
+        Ticks deadline = ExpiryTime<Clock>::after(ttl);
+        int hzCellIndex = hazardDomain->acquireCell();
+        Node<T>* node = search(value, hzCellIndex);
+        bool result = node != nullptr && node->extend(ExpiryTime<Clock>::now(), deadline);
+        hazardDomain->releaseCell(hzCellIndex);
+        return result;
+    }
+
+    // Removes expired keys in key order and returns how many it removed. A call looks at no
+    // more than budget keys and the next one carries on after the last of them, starting over
+    // once it reaches the end, so a thread calling it every so often pays for expiry a bit at
+    // a time instead of all at once when a batch of deadlines passes. Expired runs are
+    // unlinked from level 0 as the walk passes them, the towers are unlinked and retired a
+    // PopBatch at a time. One thread at a time.
+    unsigned int expireSome(unsigned int budget) {
+        static_assert(ExpiryTime<Clock>::isExpiring, "expiring keys need a list with a Clock");
+        PopBatch batch;
+        unsigned int numOfExpired = 0;
+        unsigned int numOfVisited = 0;
+        bool isAtEnd = false;
+        Ticks now = ExpiryTime<Clock>::now();
+        int hzCellIndex = hazardDomain->acquireCell();
+        while (numOfVisited < budget && !isAtEnd) {
+            isAtEnd = sweepExpired(now, budget, numOfVisited, batch, hzCellIndex);
+            numOfExpired += batch.count;
+            flushPops(batch, hzCellIndex);
+        }
+        hazardDomain->releaseCell(hzCellIndex);
+        return numOfExpired;
+    }
+
+    // Builds the key from args right in a new node, which is freed again if the key is present
+    template <class... Args> bool emplace(Args&&... args) {
+        Node<T>* preds[heightLimit];
+        Node<T>* succs[heightLimit];
+        bool inserted;
+        Node<T>* newNode = Node<T>::emplace(getRandomLevel(), std::forward<Args>(args)...);
+        auto make = [newNode](unsigned int) { return newNode; };
+        int hzCellIndex = hazardDomain->acquireCell();
+        Finger* finger = fingerOf(hzCellIndex);
+        if(finger != nullptr) {
+            insertNode(newNode, &newNode->value, newNode->level, make, inserted, hzCellIndex, finger->preds, finger->succs,
+                       fingerUseOf(*finger, hzCellIndex));
+        } else {
+            insertNode(newNode, &newNode->value, newNode->level, make, inserted, hzCellIndex, preds, succs, noFingers);
+        }
+        hazardDomain->releaseCell(hzCellIndex);
+        return inserted;
+    }
+
+    bool remove(const T& value) {
+        return remove<T>(value);
+    }
+
+    template <class K, class = IfKey<K>> bool remove(const K& value) {
+        Node<T>* preds[heightLimit];
+        Node<T>* succs[heightLimit];
+        bool result;
+        int hzCellIndex = hazardDomain->acquireCell();
+        Finger* finger = fingerOf(hzCellIndex);
+        if(finger != nullptr) {
+            result = removeFrom(value, finger->preds, finger->succs, hzCellIndex, fingerUseOf(*finger, hzCellIndex));
+        } else {
+            result = removeFrom(value, preds, succs, hzCellIndex, noFingers);
+        }
+        hazardDomain->releaseCell(hzCellIndex);
+        return result;
+    }
+
+    // Adds the keys of [begin, end) and returns how many of them were absent. The batch is sorted
+    // and every search starts from the preds of the previous key, so a run of k keys that land
+    // close together costs about O(k + log n) instead of O(k log n).
+    template <class It> int insertBatch(It begin, It end) {
+        std::vector<T> values = sortedBatch(begin, end);
+        Node<T>* preds[heightLimit];
+        Node<T>* succs[heightLimit];
+        bool inserted;
+        int numOfInserted = 0;
+        int hzCellIndex = hazardDomain->acquireCell();
+        for (unsigned int i = 0; i < values.size(); ++i) {
+            insertFrom(values[i], inserted, hzCellIndex, preds, succs, i > 0 ? eachFinger : noFingers);
+            numOfInserted += inserted;
+        }
+        hazardDomain->releaseCell(hzCellIndex);
+        return numOfInserted;
+    }
+
+    // Removes the keys of [begin, end) and returns how many of them were present, see insertBatch()
+    template <class It> int removeBatch(It begin, It end) {
+        std::vector<T> values = sortedBatch(begin, end);
+        Node<T>* preds[heightLimit];
+        Node<T>* succs[heightLimit];
+        int numOfRemoved = 0;
+        int hzCellIndex = hazardDomain->acquireCell();
+        for (unsigned int i = 0; i < values.size(); ++i) {
+            numOfRemoved += removeFrom(values[i], preds, succs, hzCellIndex, i > 0 ? eachFinger : noFingers);
+        }
+        hazardDomain->releaseCell(hzCellIndex);
+        return numOfRemoved;
+    }
+
+    // Number of keys, summed over the per-cell counters without stopping updates, so it is exact
+    // only while none is running. Expired keys count until they are removed.
+    unsigned long long size() {
+        long long sum = 0;
+        for (unsigned int i = 0; i < sizeCounters->size(); ++i) {
+            for (unsigned int lvl = 0; lvl < maxHeight; ++lvl) {
+                sum += sizeCounters->get(i)->numOfNodes[lvl].load(std::memory_order_relaxed);
+            }
+        }
+        return sum > 0 ? (unsigned long long)sum : 0;
+    }
+
+    // Approximate number of keys < value. A search counts its hops per level from the highest
+    // level with at least rankSampleSize towers, and a hop on level lvl skips about
+    // size()/(towers reaching lvl) keys; the error is around 1/sqrt(towers passed on that level).
+    unsigned long long rank(const T& value) {
+        return rank<T>(value);
+    }
+
+    template <class K, class = IfKey<K>> unsigned long long rank(const K& value) {
+        double numOfTowers[heightLimit];
+        unsigned long long hopsPerLevel[heightLimit] = {};
+        int numOfLevels = countTowers(numOfTowers);
+        int startLvl = sampleLevel(numOfTowers, numOfLevels);
+        int hzCellIndex = hazardDomain->acquireCell();
+        descend(startLvl, hzCellIndex,
+                [&](int lvl, Node<T>* node) {
+                    if(!isLess(node->value, value)) {
+                        return false;
+                    }
+                    ++hopsPerLevel[lvl];
+                    return true;
+                },
+                [&]() { std::fill(hopsPerLevel, hopsPerLevel + startLvl + 1, 0); });
+        hazardDomain->releaseCell(hzCellIndex);
+        double result = 0;
+        for (int lvl = 0; lvl <= startLvl; ++lvl) {
+            result += hopsPerLevel[lvl] * widthOf(lvl, numOfTowers);
+        }
+        result = result < numOfTowers[0] ? result : numOfTowers[0];
+        return (unsigned long long)(result + 0.5);
+    }
+
+    // Approximate i-th smallest key, counting from 0: a descent like rank()'s that hops while
+    // the keys a hop skips on average still fit in the distance left, ending with exact steps
+    // on level 0. An i past the end gives the greatest key. Returns false if the list is empty.
+    bool select(unsigned long long i, T& result) {
+        double numOfTowers[heightLimit];
+        int numOfLevels = countTowers(numOfTowers);
+        int startLvl = sampleLevel(numOfTowers, numOfLevels);
+        double remaining = (double)i + 1;
+        int hzCellIndex = hazardDomain->acquireCell();
+        Node<T>* node = descend(startLvl, hzCellIndex,
+                                [&](int lvl, Node<T>*) {
+                                    double width = widthOf(lvl, numOfTowers);
+                                    if(width > remaining) {
+                                        return false;
+                                    }
+                                    remaining -= width;
+                                    return true;
+                                },
+                                [&]() { remaining = (double)i + 1; });
+        if(node != head) {
+            result = node->value;
+        }
+        hazardDomain->releaseCell(hzCellIndex);
+        return node != head;
+    }
+
+    // Removes the smallest key into result, returns false if the list is empty. A pop marks
+    // level 0 of the first unmarked node and leaves it linked: pops skip the marked run at the
+    // front without unlinking it node by node, and one that skipped more than
+    // PopBatch::capacity nodes unlinks the whole run with one CAS on head. Each cell unlinks
+    // the rest of the towers of its pops and retires them a batch at a time.
+    bool popMin(T& result) {
+        int hzCellIndex = hazardDomain->acquireCell();
+        Node<T>* node;
+        // expired keys are dropped on the way
+        while ((node = popFirst(hzCellIndex)) != nullptr && hasExpired(node)) {
+            popped(node, hzCellIndex);
+        }
+        if(node != nullptr) {
+            result = node->value;
+            popped(node, hzCellIndex);
+        }
+        hazardDomain->releaseCell(hzCellIndex);
+        return node != nullptr;
+    }
+
+    // Relaxed popMin() after the SprayList: a random walk down from a few levels up picks one
+    // of roughly the first threads*log(threads) keys, so concurrent pops seldom collide. It
+    // falls back to popMin() near the end of the list.
+    bool popApproxMin(T& result) {
+        int hzCellIndex = hazardDomain->acquireCell();
+        Node<T>* node;
+        while (true) {
+            node = sprayPop(hzCellIndex);
+            if(node == nullptr) {
+                node = sprayPop(hzCellIndex);
+            }
+            if(node == nullptr) {
+                node = popFirst(hzCellIndex);
+            }
+            if(node == nullptr || !hasExpired(node)) {
+                break;
+            }
+            popped(node, hzCellIndex);
+        }
+        if(node != nullptr) {
+            result = node->value;
+            popped(node, hzCellIndex);
+        }
+        hazardDomain->releaseCell(hzCellIndex);
+        return node != nullptr;
+    }
+
+    // auto handle = list.attach(); at the start of a worker thread. With withFinger the thread's
+    // contains(), add() and remove() start from where its previous search ended, which makes
+    // runs of nearby keys cost O(log d) in the distance d between them. The finger relies on
+    // hazards kept between operations, so it does nothing with EpochDomain.
+    ThreadHandle attach(bool withFinger = false) {
+        hazardDomain->attachThread();
+        ThreadHandle handle(this);
+        if(withFinger) {
+            int hzCellIndex = hazardDomain->acquireCell();
+            unsigned int size;
+            while ((size = fingers->size()) <= hzCellIndex) {
+                fingers->grow(size, [](void* memory) { new (memory) Finger(); });
+            }
+            Finger* finger = fingers->get(hzCellIndex);
+            std::fill(finger->preds, finger->preds + heightLimit, head);
+            std::fill(finger->succs, finger->succs + heightLimit, tail);
+            finger->isEnabled = true;
+            handle.fingerCellIndex = hzCellIndex;
+            hazardDomain->releaseCell(hzCellIndex);
+        }
+        return handle;
+    }
+
+    Iterator begin() {
+        return makeIterator(static_cast<const T*>(nullptr), false);
+    }
+
+    Iterator end() {
+        return Iterator(this, tail, -1);
+    }
+
+    // First key >= value
+    Iterator lowerBound(const T& value) {
+        return lowerBound<T>(value);
+    }
+
+    template <class K, class = IfKey<K>> Iterator lowerBound(const K& value) {
+        return makeIterator(&value, false);
+    }
+
+    // First key > value
+    Iterator upperBound(const T& value) {
+        return upperBound<T>(value);
+    }
+
+    template <class K, class = IfKey<K>> Iterator upperBound(const K& value) {
+        return makeIterator(&value, true);
+    }
+
+    // Smallest key >= value
+    bool ceiling(const T& value, T& result) {
+        return ceiling<T>(value, result);
+    }
+
+    template <class K, class = IfKey<K>> bool ceiling(const K& value, T& result) {
+        int hzCellIndex = hazardDomain->acquireCell();
+        Node<T>* node = seek(&value, false, hzCellIndex);
+        if(node != tail) {
+            result = node->value;
+        }
+        hazardDomain->releaseCell(hzCellIndex);
+        return node != tail;
+    }
+
+    // Greatest key <= value
+    bool floor(const T& value, T& result) {
+        return floor<T>(value, result);
+    }
+
+    template <class K, class = IfKey<K>> bool floor(const K& value, T& result) {
+        Node<T>* preds[heightLimit];
+        Node<T>* succs[heightLimit];
+        int hzCellIndex = hazardDomain->acquireCell();
+        Node<T>* node = find(value, preds, succs, hzCellIndex) ? succs[0] : preds[0];
+        // an expired node can't be stepped back from, remove it and search again
+        while (node != head && hasExpired(node)) {
+            removeNode(node, preds, succs, hzCellIndex);
+            node = find(value, preds, succs, hzCellIndex) ? succs[0] : preds[0];
+        }
+        if(node != head) {
+            result = node->value;
+        }
+        hazardDomain->releaseCell(hzCellIndex);
+        return node != head;
+    }
+
+    // Calls callback(key) for every key in [lo, hi] in ascending order, returns the number of calls.
+    // Same consistency as Iterator.
+    template <class F> int rangeScan(const T& lo, const T& hi, F callback) {
+        return scan(lo, hi, [&callback](Node<T>* node) { callback(node->value); });
+    }
+
+    // Starts logging every add and remove that takes effect (popMin(), popApproxMin() and
+    // expiries included) into the returned feed, which lives as long as the list; a consumer thread
+    // calls drain() or drainTo() on it, see change_feed.h. Call it before other threads use
+    // the list. Bulk loads and value updates of maps aren't logged. Writers never wait for the
+    // consumer, a change that finds its ring full is dropped and counted.
+    ChangeFeed<T>& enableChangeFeed(unsigned int ringCapacity = 4096) {
+        if(changeFeed == nullptr) {
+            changeFeed = new ChangeFeed<T>(popBatches->size(), ringCapacity);
+        }
+        return *changeFeed;
+    }
+
+    // Dumps the keys (and mapped values) in order to a snapshot file at path, see
+    // snapshot_file.h. Same consistency as Iterator, other threads may keep updating the list.
+    // The cell is released every snapshotChunkSize keys so a long dump doesn't hold up
+    // reclamation. Returns false on an I/O error, an existing file at path is kept then.
+    // Expired keys are left out, the others are saved with the time they have left, which
+    // loadSnapshot() counts from the load.
+    bool saveSnapshot(const char* path) {
+        static_assert(std::is_trivially_copyable<T>::value, "snapshots store keys as raw bytes");
+        SnapshotWriter writer(path, sizeof(T), MappedValue<V>::numOfBytes, ExpiryTime<Clock>::numOfExpiryBytes);
+        std::vector<char> record(sizeof(T) + MappedValue<V>::numOfBytes + ExpiryTime<Clock>::numOfExpiryBytes);
+        int hzCellIndex = hazardDomain->acquireCell();
+        Node<T>* node = seek(static_cast<const T*>(nullptr), false, hzCellIndex);
+        for (unsigned long long i = 1; node != tail; ++i) {
+            std::memcpy(record.data(), &node->value, sizeof(T));
+            node->saveTo(record.data() + sizeof(T));
+            node->saveExpiryTo(record.data() + sizeof(T) + MappedValue<V>::numOfBytes, ExpiryTime<Clock>::now());
+            writer.add(record.data());
+            if(i % snapshotChunkSize == 0) {
+                T last = node->value;
+                hazardDomain->releaseCell(hzCellIndex);
+                hzCellIndex = hazardDomain->acquireCell();
+                node = seek(&last, true, hzCellIndex);
+            } else {
+                node = next(node, hzCellIndex);
+            }
+        }
+        hazardDomain->releaseCell(hzCellIndex);
+        return writer.finish();
+    }
+
+    // Fills an empty list from a snapshot in one pass over the mapped file: the records are
+    // already sorted, so every node is appended to the last tower on each of its levels
+    // without searching. No other thread may use the list until it returns. Returns false,
+    // leaving the list empty, if the list isn't empty or the file isn't a valid snapshot of
+    // this key, value and clock type. Keys that expire get the time they had left when saved.
+    bool loadSnapshot(const char* path) {
+        static_assert(std::is_trivially_copyable<T>::value, "snapshots store keys as raw bytes");
+        if(head->nexts[0].getRef() != tail) {
+            return false;
+        }
+        SnapshotReader reader;
+        if(!reader.open(path, sizeof(T), MappedValue<V>::numOfBytes, ExpiryTime<Clock>::numOfExpiryBytes)) {
+            return false;
+        }
+        std::size_t recordSize = sizeof(T) + MappedValue<V>::numOfBytes + ExpiryTime<Clock>::numOfExpiryBytes;
+        Ticks now = ExpiryTime<Clock>::now();
+        const char* record = reader.records();
+        Node<T>* lasts[heightLimit];
+        std::fill(lasts, lasts + maxHeight, head);
+        // records aren't aligned for T
+        alignas(T) char keyBytes[sizeof(T)];
+        const T& key = *reinterpret_cast<const T*>(keyBytes);
+        int hzCellIndex = hazardDomain->acquireCell();
+        for (unsigned long long i = 0; i < reader.count(); ++i, record += recordSize) {
+            std::memcpy(keyBytes, record, sizeof(T));
+            // a snapshot made with another order would break the list, skip what is out of order
+            if(lasts[0] == head || isLess(lasts[0]->value, key)) {
+                Node<T>* node = Node<T>::create(key, getRandomLevel());
+                node->loadFrom(record + sizeof(T));
+                node->loadExpiryFrom(record + sizeof(T) + MappedValue<V>::numOfBytes, now);
+                append(node, lasts, hzCellIndex);
+            }
+        }
+        hazardDomain->releaseCell(hzCellIndex);
+        return true;
+    }
+
+    void print() {
+        int i = 0;
+        for (Node<T> *p = head; p!=tail; p=p->nexts[0].getRef()) {
+            if(p == head) {
+                std::cout << i++ << ".\th [" << p->level << "]\t->\t";
+            } else {
+                std::cout << i++ << ".\t" << p->value << " [" << p->level << "]\t->\t";
+            }
+            for (int j = 0; j <= p->level; ++j) {
+                if(p->nexts[j].getRef() != tail) {
+                    std::cout << p->nexts[j].getRef()->value << "[" << p->nexts[j].getMark() << "]\t";
+                } else {
+                    std::cout << "n[0]\t";
+                }
+            }
+            std::cout << std::endl;
+        }
+    }
+
+    unsigned long long getNumOfRetiredNodes() {
+        return hazardDomain->getNumOfRetired();
+    }
+
+    unsigned long long getNumOfFreedNodes() {
+        return hazardDomain->getNumOfFreed();
+    }
+
+    unsigned long long getNumOfPendingNodes() {
+        return hazardDomain->getNumOfPending();
+    }
+
+#ifdef SKIPLIST_STATS
+    SkipListStats stats() {
+        SkipListStats result;
+        for (int i = 0; i < operationStats->size(); ++i) {
+            operationStats->get(i)->collect(result);
+        }
+        hazardDomain->collectStats(result);
+        return result;
+    }
+#endif
+
+    void checkForLockFree() {
+        for(Node<T>* curr = head; curr != tail; curr = curr->nexts[0].getRef()) {
+            std::cout << "Node " << curr->value << ":" << std::endl;
+            checkNodeForLockFree(curr);
+        }
+    }
 
-        for (int lvl = maxHeight-1; lvl >= botLvl; --lvl) {
-            curr = hazardDomain->protect(pred->nexts[lvl].getRef(), hzCellIndex, 1);
-            while(true) {
-                succ = hazardDomain->protect(curr->nexts[lvl].getRefAndMark(mark), hzCellIndex, 2);
-                while(curr != tail && mark) {
-                    curr = hazardDomain->protect(curr->nexts[lvl].getRef(), hzCellIndex, 1);
-                    succ = hazardDomain->protect(curr->nexts[lvl].getRefAndMark(mark), hzCellIndex, 2);
-                }
-                if(compare(curr, value) < 0) {
-                    pred = hazardDomain->protect(curr, hzCellIndex, 0);
-                    curr = hazardDomain->protect(succ, hzCellIndex, 1);
-                } else {
-                    break;
-                }
-            }
+// PROTECTED METHODS
+protected:
+    // Returns the unmarked, unexpired node holding value or nullptr. The node stays protected
+    // in hzCellIndex until the next traversal in the cell.
+    template <class K> Node<T>* search(const K& value, int hzCellIndex) {
+        if(isMirrored && mirror->isStale()) {
+            rebuildMirror(hzCellIndex);
         }
+        Node<T>* curr = locate(value, nullptr, nullptr, hzCellIndex);
+        return isEqual(curr, value) && isAlive(curr, hzCellIndex) ? curr : nullptr;
+    }
 
-        bool result = (compare(curr, value) == 0);
-        hazardDomain->releaseCell(hzCellIndex);
-        return result;
+    // Neither removed nor expired, for maps checking a node after updating its value
+    bool isPresent(Node<T>* node) {
+        return !node->nexts[0].getMark() && !hasExpired(node);
     }
 
-    bool find(T value, Node<T>** preds, Node<T>** succs, int hzCellIndex) {
-        int botLvl = 0;
+    // Hand-over-hand search for the first node >= value on every level from topLevel down, the
+    // empty head levels above it are skipped. pred, curr and succ
+    // rotate through slots 0-2, so a hop publishes one pointer and validates it with one
+    // reload. Removed nodes met on the way are unlinked; the search restarts from head when
+    // that fails or when pred turns out to be removed, because a marked link may point to a
+    // node that is already retired. If preds/succs are given they are filled and protected
+    // in slots 2*lvl+4 and 2*lvl+5, a slot that already holds the node isn't written again.
+    // With eachFinger, preds must still be protected by an earlier search in the same cell; a
+    // level then starts from preds[lvl] when it lies between the pred carried down and value,
+    // and falls back to the former if the finger has been removed. With lowestFinger the first
+    // try instead starts right at the lowest level whose pred and succ bracket value and
+    // leaves the levels above it as they were, so only preds/succs up to that level are valid.
+    // Without preds the first try of a search for a T starts from the mirrored level when there
+    // is a mirror. Every hop costs one comparison. Returns the level 0 successor, protected
+    // like succs[0].
+    template <class K> Node<T>* locate(const K& value, Node<T>** preds, Node<T>** succs, int hzCellIndex, FingerUse fingerUse = noFingers) {
         bool mark;
-
         Node<T>* pred;
-        Node<T>* curr;
+        Node<T>* curr = tail;
         Node<T>* succ;
+        int predSlot, currSlot, succSlot;
+        int topLvl;
+        int startLvl;
+        bool fromMirror = isMirrored && std::is_same<K, T>::value && preds == nullptr;
+        SKIPLIST_STAT(unsigned long long numOfStarts = 0);
+        SKIPLIST_STAT(unsigned long long numOfHops = 0);
 
     retry:
-        while (true) {
-            pred = hazardDomain->protect(head, hzCellIndex, 0);
-            for (int lvl = maxHeight-1; lvl >= botLvl; --lvl) {
-                curr = hazardDomain->protect(pred->nexts[lvl].getRef(), hzCellIndex, 1);
-                // linearization point if lvl == 0
-                while (true) {
-                    succ = hazardDomain->protect(curr->nexts[lvl].getRefAndMark(mark), hzCellIndex, 2);
-                    while (curr != tail && mark){
-                        if(!pred->nexts[lvl].CAS(curr, succ, false, false)) {
-                            goto retry;
-                        }
-                        curr = hazardDomain->protect(pred->nexts[lvl].getRef(), hzCellIndex, 1);
-                        // linearization point if lvl == 0
-                        succ = hazardDomain->protect(curr->nexts[lvl].getRefAndMark(mark), hzCellIndex, 2);
+        SKIPLIST_STAT(++numOfStarts);
+        // head is never retired, so it needs no slot
+        pred = head;
+        predSlot = 0;
+        currSlot = 1;
+        succSlot = 2;
+        topLvl = topLevel.load(std::memory_order_acquire);
+        startLvl = topLvl;
+        if(fromMirror) {
+            // first try only, the mirrored node may be the removed one the search restarts for
+            fromMirror = false;
+            mirrorStart(value, pred, startLvl, hzCellIndex);
+        }
+        if(fingerUse == lowestFinger) {
+            // first try only as well, the search restarts from head if the finger was removed
+            fingerUse = noFingers;
+            int fingerLvl = fingerLevel(value, preds, succs, topLvl);
+            if(fingerLvl >= 0) {
+                // still protected in slot 2*lvl+4 by the earlier search
+                startLvl = fingerLvl;
+                pred = preds[fingerLvl];
+            }
+        }
+        for (int lvl = startLvl; lvl >= 0; --lvl) {
+            Node<T>* carried = pred;
+            if(fingerUse == eachFinger && preds[lvl] != head && isLess(preds[lvl]->value, value)
+               && (pred == head || isLess(pred->value, preds[lvl]->value))) {
+                // still protected in slot 2*lvl+4 by the earlier search
+                pred = preds[lvl];
+            }
+            curr = hazardDomain->protect(pred->nexts[lvl], mark, hzCellIndex, currSlot);
+            if(mark && pred != carried) {
+                pred = carried;
+                curr = hazardDomain->protect(pred->nexts[lvl], mark, hzCellIndex, currSlot);
+            }
+            if(mark) {
+                helpRemove(pred, hzCellIndex);
+                goto retry;
+            }
+            while(curr != tail) {
+                succ = hazardDomain->protect(curr->nexts[lvl], mark, hzCellIndex, succSlot);
+                if(mark) {
+                    if(!pred->nexts[lvl].CAS(curr, succ, false, false)) {
+                        SKIPLIST_STAT(statsOf(hzCellIndex).casFailures[lvl].add());
+                        goto retry;
                     }
-
-                    if(compare(curr, value) < 0) {
-                        pred = hazardDomain->protect(curr, hzCellIndex, 0);
-                        curr = hazardDomain->protect(succ, hzCellIndex, 1);
-                    } else {
-                        break;
+                    curr = hazardDomain->protect(pred->nexts[lvl], mark, hzCellIndex, currSlot);
+                    if(mark) {
+                        helpRemove(pred, hzCellIndex);
+                        goto retry;
                     }
+                    continue;
                 }
-
-                preds[lvl] = hazardDomain->protect(pred, hzCellIndex, 2 * lvl + 4);
-                succs[lvl] = hazardDomain->protect(curr, hzCellIndex, 2 * lvl + 5);
+                // linearization point if lvl == 0
+                if(!isLess(curr->value, value)) {
+                    break;
+                }
+                pred = curr;
+                curr = succ;
+                SKIPLIST_STAT(++numOfHops);
+                int freeSlot = predSlot;
+                predSlot = currSlot;
+                currSlot = succSlot;
+                succSlot = freeSlot;
             }
 
-            return compare(curr, value) == 0;
+            if(preds != nullptr) {
+                hazardDomain->reprotect(pred, hzCellIndex, 2 * lvl + 4);
+                hazardDomain->reprotect(curr, hzCellIndex, 2 * lvl + 5);
+                preds[lvl] = pred;
+                succs[lvl] = curr;
+            }
+        }
+        if(preds != nullptr) {
+            // the levels above were empty when the search began; a finger search skips head
+            // and a CAS expecting tail there fails if a tower got linked meanwhile
+            for (int lvl = topLvl + 1; lvl < maxHeight; ++lvl) {
+                preds[lvl] = head;
+                succs[lvl] = tail;
+            }
         }
+#ifdef SKIPLIST_STATS
+        OperationStats& stats = statsOf(hzCellIndex);
+        stats.numOfSearches.add();
+        stats.numOfTraversedNodes.add(numOfHops);
+        stats.numOfFindRestarts.add(numOfStarts - 1);
+#endif
+        return curr;
+    }
+
+    // Links a new node holding value (and mapped, for maps) unless value is already present.
+    // Returns the node holding value, protected in hzCellIndex until the cell is released.
+    // An rvalue value is moved into the new node.
+    template <class U, class... M> Node<T>* insert(U&& value, bool& inserted, int hzCellIndex, M... mapped) {
+        Node<T>* preds[heightLimit];
+        Node<T>* succs[heightLimit];
+        return insertFrom(std::forward<U>(value), inserted, hzCellIndex, preds, succs, noFingers, mapped...);
+    }
+
+    // insert() with caller-provided preds/succs; fingerUse as in locate(). The searches after
+    // the first one always start from the fingers, they hold preds of the same key by then.
+    template <class U, class... M> Node<T>* insertFrom(U&& value, bool& inserted, int hzCellIndex,
+                                                       Node<T>** preds, Node<T>** succs, FingerUse fingerUse, M... mapped) {
+        auto make = [&value, &mapped...](unsigned int lvl) { return Node<T>::create(std::forward<U>(value), lvl, mapped...); };
+        return insertNode(nullptr, &value, getRandomLevel(), make, inserted, hzCellIndex, preds, succs, fingerUse);
     }
 
-    bool add(T value) {
-        unsigned int topLvl = getRandomLevel();
+    // insertFrom() of newNode, or of a node make(topLvl) builds from *key once the key is found
+    // absent. key then moves to the node, whose value may have been moved from it. A node
+    // that isn't linked is destroyed.
+    template <class Make> Node<T>* insertNode(Node<T>* newNode, const T* key, unsigned int topLvl, Make make, bool& inserted,
+                                              int hzCellIndex, Node<T>** preds, Node<T>** succs, FingerUse fingerUse) {
         int botLvl = 0;
-        int hzCellIndex = hazardDomain->acquireCell();
-        Node<T>** preds = new Node<T>*[maxHeight];
-        Node<T>** succs = new Node<T>*[maxHeight];
 
         while(true) {
-            if(find(value, preds, succs, hzCellIndex)){
-                delete[] preds;
-                delete[] succs;
-                hazardDomain->releaseCell(hzCellIndex);
-                return false;
+            if(find(*key, preds, succs, hzCellIndex, fingerUse)){
+                if(hasExpired(succs[botLvl])) {
+                    // refinds preds/succs from the fingers
+                    removeNode(succs[botLvl], preds, succs, hzCellIndex);
+                    fingerUse = eachFinger;
+                    continue;
+                }
+                if(newNode != nullptr) {
+                    Node<T>::destroy(newNode);
+                }
+                inserted = false;
+                return succs[botLvl];
+            }
+            if(fingerUse == lowestFinger && !isBracketed(*key, preds, succs, botLvl + 1, topLvl)) {
+                // the new tower is taller than the levels the finger search refreshed
+                fingerUse = eachFinger;
+                continue;
             }
 
-            Node<T>* newNode = new Node<T>(value, topLvl);
+            if(newNode == nullptr) {
+                newNode = make(topLvl);
+                key = &newNode->value;
+            }
             for (int lvl = botLvl; lvl <= topLvl; ++lvl) {
                 newNode->nexts[lvl].setVal(succs[lvl], false);
             }
@@ -160,122 +1179,721 @@ public:
             Node<T>* succ = succs[botLvl];
 
             hazardDomain->protect(newNode, hzCellIndex, 3);
+            fingerUse = eachFinger;
+            unsigned long long seq = reserveChange(hzCellIndex);
             if(!pred->nexts[botLvl].CAS(succ, newNode, false, false)) {
-                delete newNode;
+                SKIPLIST_STAT(statsOf(hzCellIndex).casFailures[botLvl].add());
+                cancelChange(hzCellIndex);
                 continue;
             }
             // linearization point
+            publishChange(hzCellIndex, seq, ChangeFeed<T>::added, newNode->value);
+            countersOf(hzCellIndex).add(topLvl, 1);
+            if(isMirrored) {
+                mirror->inserted(topLvl);
+            }
 
-            for (int lvl = botLvl+1; lvl <= topLvl; ++lvl) {
+            bool isLinking = true;
+            for (int lvl = botLvl+1; isLinking && lvl <= topLvl; ++lvl) {
                 while(true) {
                     pred = preds[lvl];
                     succ = succs[lvl];
+                    // a refind may have moved the successor of any level still to be linked, point
+                    // the new node at it first; its links get marked if it is removed meanwhile
+                    // and the tower is left as it is
+                    bool mark;
+                    Node<T>* next = newNode->nexts[lvl].getRefAndMark(mark);
+                    if(mark || (next != succ && !newNode->nexts[lvl].CAS(next, succ, false, false))) {
+                        isLinking = false;
+                        break;
+                    }
                     if(pred->nexts[lvl].CAS(succ, newNode, false, false)) {
                         break;
                     }
-                    find(value, preds, succs, hzCellIndex);
+                    SKIPLIST_STAT(statsOf(hzCellIndex).casFailures[lvl].add());
+                    SKIPLIST_STAT(statsOf(hzCellIndex).numOfLinkRetries.add());
+                    if(!find(newNode->value, preds, succs, hzCellIndex, eachFinger) || succs[botLvl] != newNode) {
+                        isLinking = false;
+                        break;
+                    }
                 }
             }
+            // removed while the tower was being linked: the remover's find may have run before
+            // some of the levels were linked, unlink them here
+            if(newNode->nexts[botLvl].getMark(std::memory_order_seq_cst)) {
+                find(newNode->value, preds, succs, hzCellIndex, eachFinger);
+            }
 
-            delete[] preds;
-            delete[] succs;
-            hazardDomain->releaseCell(hzCellIndex);
-            return true;
+            inserted = true;
+            return newNode;
+        }
+    }
+
+    // remove() with caller-provided preds/succs; fingerUse as in locate(). An expired key is
+    // removed all the same but reported absent.
+    template <class K> bool removeFrom(const K& value, Node<T>** preds, Node<T>** succs, int hzCellIndex, FingerUse fingerUse) {
+        if(!find(value, preds, succs, hzCellIndex, fingerUse)) {
+            return false;
+        }
+        bool isExpired = hasExpired(succs[0]);
+        return removeNode(succs[0], preds, succs, hzCellIndex) && !isExpired;
+    }
+
+    // Removes a node that the last search with preds/succs found, then searches again from
+    // the fingers to unlink its tower before retiring it. Returns false if another thread
+    // removed it first.
+    bool removeNode(Node<T>* toRemove, Node<T>** preds, Node<T>** succs, int hzCellIndex) {
+        hazardDomain->protect(toRemove, hzCellIndex, 3);
+        markTower(toRemove, hzCellIndex);
+        if(!markRemoved(toRemove, hzCellIndex)) {
+            return false;
+        }
+        countersOf(hzCellIndex).add(toRemove->level, -1);
+        find(toRemove->value, preds, succs, hzCellIndex, eachFinger);
+        if(isMirrored && toRemove->level >= 1) {
+            mirror->removed(toRemove->level);
         }
+        hazardDomain->deletePtr(toRemove, hzCellIndex);
+        return true;
     }
 
-    bool remove(T value) {
+    // Marks level 0 of the node, the linearization point of its removal, and logs it to the
+    // change feed. Returns false if another thread marked it first.
+    bool markRemoved(Node<T>* node, int hzCellIndex) {
         bool mark;
-        int botLvl = 0;
+        Node<T>* succ = node->nexts[0].getRefAndMark(mark);
+        while (!mark) {
+            unsigned long long seq = reserveChange(hzCellIndex);
+            if(node->nexts[0].weakCAS(succ, succ, false, true)) {
+                publishChange(hzCellIndex, seq, ChangeFeed<T>::removed, node->value);
+                return true;
+            }
+            cancelChange(hzCellIndex);
+            SKIPLIST_STAT(statsOf(hzCellIndex).casFailures[0].add());
+            SKIPLIST_STAT(statsOf(hzCellIndex).numOfMarkRetries.add());
+            succ = node->nexts[0].getRefAndMark(mark);
+        }
+        return false;
+    }
+
+    template <class K, class F> int scan(const K& lo, const K& hi, F visit) {
+        int count = 0;
         int hzCellIndex = hazardDomain->acquireCell();
-        Node<T>** preds = new Node<T>*[maxHeight];
-        Node<T>** succs = new Node<T>*[maxHeight];
-        Node<T>* succ;
+        for (Node<T>* node = seek(&lo, false, hzCellIndex); node != tail; node = next(node, hzCellIndex)) {
+            if(isLess(hi, node->value)) {
+                break;
+            }
+            visit(node);
+            ++count;
+        }
+        hazardDomain->releaseCell(hzCellIndex);
+        return count;
+    }
 
-        while(true) {
-            if(!find(value, preds, succs, hzCellIndex)) {
-                delete[] preds;
-                delete[] succs;
-                hazardDomain->releaseCell(hzCellIndex);
+    // First unmarked, unexpired node with key >= *value (> if strict), or the first one if value
+    // is nullptr. The result is protected in slot 3.
+    template <class K> Node<T>* seek(const K* value, bool strict, int hzCellIndex) {
+        if(value == nullptr) {
+            return next(head, hzCellIndex);
+        }
+        Node<T>* preds[heightLimit];
+        Node<T>* succs[heightLimit];
+        bool found = find(*value, preds, succs, hzCellIndex);
+        Node<T>* node = hazardDomain->protect(succs[0], hzCellIndex, 3);
+        if((found && strict) || hasExpired(node)) {
+            return next(node, hzCellIndex);
+        }
+        return node;
+    }
+
+    // Successor of a node protected in slot 3. Removed successors are unlinked as in locate(),
+    // a search by key wouldn't do it since they lie past the key, and popped ones stay linked
+    // until their batch is flushed. Expired ones are only stepped over. If the node has been
+    // removed meanwhile its links can't be trusted, so the search restarts from the top by key.
+    Node<T>* next(Node<T>* node, int hzCellIndex) {
+        bool mark;
+        Node<T>* succ = hazardDomain->protect(node->nexts[0], mark, hzCellIndex, 2);
+        while (!mark && succ != tail) {
+            Node<T>* after = succ->nexts[0].getRefAndMark(mark);
+            if(!mark) {
+                node = hazardDomain->protect(succ, hzCellIndex, 3);
+                if(!hasExpired(node)) {
+                    return node;
+                }
+                succ = hazardDomain->protect(node->nexts[0], mark, hzCellIndex, 2);
+                continue;
+            }
+            if(!node->nexts[0].CAS(succ, after, false, false)) {
+                SKIPLIST_STAT(statsOf(hzCellIndex).casFailures[0].add());
+            }
+            succ = hazardDomain->protect(node->nexts[0], mark, hzCellIndex, 2);
+        }
+        if(!mark) {
+            return tail;
+        }
+        // the node stays protected in slot 3 until the search is done with its key
+        return seek(&node->value, true, hzCellIndex);
+    }
+
+// PRIVATE METHODS
+private:
+    // Moves the start of a search to the last mirrored node with key < value, protected in slot 0
+    void mirrorStart(const T& value, Node<T>*& pred, int& topLvl, int hzCellIndex) {
+        Node<T>* node;
+        unsigned int lvl;
+        unsigned long long seenVersion;
+        if(mirror->find(value, node, lvl, seenVersion)) {
+            hazardDomain->protect(node, hzCellIndex, 0);
+            if(mirror->isUnchanged(seenVersion)) {
+                pred = node;
+                topLvl = (int)lvl;
+            }
+        }
+    }
+
+    // add() through the cell's finger if it has one. The deadline is set once the node is
+    // linked: until then it is never, so nobody can have seen the key expire.
+    template <class U> bool addFrom(U&& value, Ticks deadline = ExpiryTime<Clock>::never) {
+        Node<T>* preds[heightLimit];
+        Node<T>* succs[heightLimit];
+        Node<T>* node;
+        bool inserted;
+        int hzCellIndex = hazardDomain->acquireCell();
+        Finger* finger = fingerOf(hzCellIndex);
+        if(finger != nullptr) {
+            node = insertFrom(std::forward<U>(value), inserted, hzCellIndex, finger->preds, finger->succs, fingerUseOf(*finger, hzCellIndex));
+        } else {
+            node = insertFrom(std::forward<U>(value), inserted, hzCellIndex, preds, succs, noFingers);
+        }
+        if(inserted && deadline != ExpiryTime<Clock>::never) {
+            node->expireAt(deadline);
+        }
+        hazardDomain->releaseCell(hzCellIndex);
+        return inserted;
+    }
+
+    // Expired nodes are absent, see ExpiryTime::claimExpired()
+    bool hasExpired(Node<T>* node) {
+        return ExpiryTime<Clock>::isExpiring && node->claimExpired();
+    }
+
+    // For lookups without preds/succs: an expired node is absent and goes through the cell's
+    // pop batch, as if popped
+    bool isAlive(Node<T>* node, int hzCellIndex) {
+        if(!hasExpired(node)) {
+            return true;
+        }
+        if(markRemoved(node, hzCellIndex)) {
+            popped(node, hzCellIndex);
+        }
+        return false;
+    }
+
+    // Around the CAS of an add or remove when the change feed is on, see ChangeFeed
+    unsigned long long reserveChange(int hzCellIndex) {
+        return changeFeed != nullptr ? changeFeed->reserve(hzCellIndex) : 0;
+    }
+
+    void cancelChange(int hzCellIndex) {
+        if(changeFeed != nullptr) {
+            changeFeed->cancel(hzCellIndex);
+        }
+    }
+
+    void publishChange(int hzCellIndex, unsigned long long seq, typename ChangeFeed<T>::Op op, const T& key) {
+        if(changeFeed != nullptr) {
+            changeFeed->publish(hzCellIndex, seq, op, key);
+        }
+    }
+
+    // Links node after lasts[lvl] on each of its levels, for building a list from sorted keys
+    // before any other thread uses it
+    void append(Node<T>* node, Node<T>** lasts, int hzCellIndex) {
+        countersOf(hzCellIndex).add(node->level, 1);
+        for (int lvl = 0; lvl <= node->level; ++lvl) {
+            node->nexts[lvl].setVal(tail, false, std::memory_order_relaxed);
+            lasts[lvl]->nexts[lvl].setVal(node, false, std::memory_order_relaxed);
+            lasts[lvl] = node;
+        }
+        if(isMirrored) {
+            mirror->inserted(node->level);
+        }
+    }
+
+    Finger* fingerOf(int cellIndex) {
+        if(fingers->size() <= cellIndex) {
+            return nullptr;
+        }
+        Finger* finger = fingers->get(cellIndex);
+        return finger->isEnabled ? finger : nullptr;
+    }
+
+    // The finger is usable if every node in it is still protected in the slot the last search
+    // of the cell left it in. Any other search with preds in the cell, or releasing a cell that
+    // isn't attached, overwrites those slots.
+    FingerUse fingerUseOf(const Finger& finger, int hzCellIndex) {
+        int top = topLevel.load(std::memory_order_acquire);
+        for (int lvl = 0; lvl <= top; ++lvl) {
+            Node<T>* pred = finger.preds[lvl];
+            Node<T>* succ = finger.succs[lvl];
+            if((pred != head && !hazardDomain->isProtected(pred, hzCellIndex, 2 * lvl + 4))
+               || (succ != tail && !hazardDomain->isProtected(succ, hzCellIndex, 2 * lvl + 5))) {
+                return noFingers;
+            }
+        }
+        return lowestFinger;
+    }
+
+    // Lowest level whose finger brackets value, or -1 if there is none or its pred is head:
+    // walking a low level from head costs more than coming down from the top
+    template <class K> int fingerLevel(const K& value, Node<T>** preds, Node<T>** succs, int topLvl) {
+        for (int lvl = 0; lvl <= topLvl; ++lvl) {
+            if(isBracketed(value, preds, succs, lvl, lvl)) {
+                return preds[lvl] == head ? -1 : lvl;
+            }
+        }
+        return -1;
+    }
+
+    // pred < value <= succ on every level in [fromLvl, toLvl]
+    template <class K> bool isBracketed(const K& value, Node<T>** preds, Node<T>** succs, int fromLvl, int toLvl) {
+        for (int lvl = fromLvl; lvl <= toLvl; ++lvl) {
+            if((preds[lvl] != head && !isLess(preds[lvl]->value, value))
+               || (succs[lvl] != tail && isLess(succs[lvl]->value, value))) {
                 return false;
             }
+        }
+        return true;
+    }
+
+    // The mirror holds T keys only
+    template <class K> void mirrorStart(const K& value, Node<T>*& pred, int& topLvl, int hzCellIndex) {}
+
+    // Marks the links of the node's levels above 0. The successors are only compared, never
+    // dereferenced, so they need no protection.
+    void markTower(Node<T>* node, int hzCellIndex) {
+        bool mark;
+        for (int lvl = node->level; lvl >= 1; --lvl) {
+            Node<T>* succ = node->nexts[lvl].getRefAndMark(mark);
+            while(!mark) {
+                if(!node->nexts[lvl].weakCAS(succ, succ, mark, true)) {
+                    SKIPLIST_STAT(statsOf(hzCellIndex).casFailures[lvl].add());
+                    SKIPLIST_STAT(statsOf(hzCellIndex).numOfMarkRetries.add());
+                }
+                succ = node->nexts[lvl].getRefAndMark(mark);
+            }
+        }
+    }
 
-            Node<T>* toRemove = hazardDomain->protect(succs[botLvl], hzCellIndex, 3);
-            for (int lvl = toRemove->level; lvl >= botLvl+1; --lvl) {
-                succ = hazardDomain->protect(toRemove->nexts[lvl].getRefAndMark(mark), hzCellIndex, 2);
-                while(!mark) {
-                    toRemove->nexts[lvl].CAS(succ, succ, mark, true);
-                    succ = hazardDomain->protect(toRemove->nexts[lvl].getRefAndMark(mark), hzCellIndex, 2);
+    // A pop or an expiry (isAlive(), sweepExpired()) marks level 0 before the levels above, the
+    // reverse of remove(), so a search can come down through such a node whose upper links are
+    // still unmarked and find it removed only on level 0. Restarting alone would meet it again
+    // until the thread that marked it gets to markTower(); marking the tower here lets the
+    // restarted search unlink it from the top.
+    void helpRemove(Node<T>* pred, int hzCellIndex) {
+        if(pred != head) {
+            markTower(pred, hzCellIndex);
+        }
+    }
+
+    // Marks level 0 of the first unmarked node and returns it, nullptr if there is none. The
+    // marked nodes before it can only be unlinked through head's link to the first of them,
+    // so while head still points there none of them is retired and the walk needs no other
+    // validation. first stays protected in slot 0 for the whole walk, curr and succ rotate
+    // through slots 1 and 2: a retired first could otherwise be reused by an add() of a new
+    // minimum and pass the check on head while the nodes behind it are freed.
+    Node<T>* popFirst(int hzCellIndex) {
+        bool mark;
+    retry:
+        // head's links are never marked
+        Node<T>* first = hazardDomain->protect(head->nexts[0], mark, hzCellIndex, 0);
+        Node<T>* curr = first;
+        int currSlot = 1;
+        int succSlot = 2;
+        unsigned int numOfSkipped = 0;
+        while (curr != tail) {
+            Node<T>* succ = curr->nexts[0].getRefAndMark(mark);
+            if(!mark) {
+                if(numOfSkipped > PopBatch::capacity && head->nexts[0].CAS(first, curr, false, false)) {
+                    first = hazardDomain->protect(curr, hzCellIndex, 0);
+                    numOfSkipped = 0;
+                }
+                // linearization point if it succeeds, otherwise curr got marked or a successor
+                unsigned long long seq = reserveChange(hzCellIndex);
+                if(curr->nexts[0].CAS(succ, succ, false, true)) {
+                    publishChange(hzCellIndex, seq, ChangeFeed<T>::removed, curr->value);
+                    return curr;
                 }
+                cancelChange(hzCellIndex);
+                SKIPLIST_STAT(statsOf(hzCellIndex).casFailures[0].add());
+                continue;
+            }
+            succ = hazardDomain->protect(curr->nexts[0], mark, hzCellIndex, succSlot);
+            if(head->nexts[0].getRef(std::memory_order_seq_cst) != first) {
+                goto retry;
             }
+            curr = succ;
+            std::swap(currSlot, succSlot);
+            ++numOfSkipped;
+        }
+        return nullptr;
+    }
 
-            succ = hazardDomain->protect(toRemove->nexts[botLvl].getRefAndMark(mark), hzCellIndex, 2);
-            while(true) {
-                bool markedIt = toRemove->nexts[botLvl].CAS(succ, succ, false, true);
-                // linearization point if markedIf == true
-                succ = hazardDomain->protect(succs[botLvl]->nexts[botLvl].getRefAndMark(mark), hzCellIndex, 2);
-                if(markedIt) {
-                    find(value, preds, succs, hzCellIndex);
-                    hazardDomain->deletePtr(toRemove, hzCellIndex);
-                    delete[] preds;
-                    delete[] succs;
-                    hazardDomain->releaseCell(hzCellIndex);
-                    return true;
-                } else {
+    // One SprayList walk: from min(sprayHeight, topLevel) down, every level moves right by a
+    // random number of nodes in [0, sprayJump], and level 0 pops the node it stops at or the
+    // first unmarked one after it. Removed nodes are unlinked as in locate(). Returns nullptr
+    // if it has to restart or runs off the end.
+    Node<T>* sprayPop(int hzCellIndex) {
+        bool mark;
+        Node<T>* pred = head;
+        Node<T>* curr;
+        Node<T>* succ;
+        int predSlot = 0;
+        int currSlot = 1;
+        int succSlot = 2;
+        int top = topLevel.load(std::memory_order_acquire);
+        top = top < (int)sprayHeight ? top : (int)sprayHeight;
+        for (int lvl = top; lvl >= 0; --lvl) {
+            unsigned int numOfSteps = (unsigned int)(LevelGenerator::draw() % (sprayJump + 1));
+            curr = hazardDomain->protect(pred->nexts[lvl], mark, hzCellIndex, currSlot);
+            if(mark) {
+                return nullptr;
+            }
+            while (curr != tail) {
+                succ = hazardDomain->protect(curr->nexts[lvl], mark, hzCellIndex, succSlot);
+                if(mark) {
+                    if(!pred->nexts[lvl].CAS(curr, succ, false, false)) {
+                        SKIPLIST_STAT(statsOf(hzCellIndex).casFailures[lvl].add());
+                        return nullptr;
+                    }
+                    curr = hazardDomain->protect(pred->nexts[lvl], mark, hzCellIndex, currSlot);
                     if(mark) {
-                        delete[] preds;
-                        delete[] succs;
-                        hazardDomain->releaseCell(hzCellIndex);
-                        return false;
+                        return nullptr;
+                    }
+                    continue;
+                }
+                if(numOfSteps == 0) {
+                    if(lvl > 0) {
+                        break;
+                    }
+                    unsigned long long seq = reserveChange(hzCellIndex);
+                    if(curr->nexts[0].CAS(succ, succ, false, true)) {
+                        publishChange(hzCellIndex, seq, ChangeFeed<T>::removed, curr->value);
+                        return curr;
                     }
+                    cancelChange(hzCellIndex);
+                    SKIPLIST_STAT(statsOf(hzCellIndex).casFailures[0].add());
+                    continue;
                 }
+                --numOfSteps;
+                pred = curr;
+                curr = succ;
+                int freeSlot = predSlot;
+                predSlot = currSlot;
+                currSlot = succSlot;
+                succSlot = freeSlot;
             }
         }
+        return nullptr;
     }
 
-    void print() {
-        int i = 0;
-        for (Node<T> *p = head; p!=tail; p=p->nexts[0].getRef()) {
-            if(p == head) {
-                std::cout << i++ << ".\th [" << p->level << "]\t->\t";
-            } else {
-                std::cout << i++ << ".\t" << p->value << " [" << p->level << "]\t->\t";
+    // After a pop or an expiry marked level 0 of the node: marks the rest of the tower and
+    // batches the node
+    void popped(Node<T>* node, int hzCellIndex) {
+        PopBatch& batch = popBatchOf(hzCellIndex);
+        addToBatch(node, batch, hzCellIndex);
+        if(batch.count == PopBatch::capacity) {
+            flushPops(batch, hzCellIndex);
+        }
+    }
+
+    void addToBatch(Node<T>* node, PopBatch& batch, int hzCellIndex) {
+        countersOf(hzCellIndex).add(node->level, -1);
+        markTower(node, hzCellIndex);
+        batch.nodes[batch.count++] = node;
+    }
+
+    // One stretch of expireSome(): walks level 0 hand over hand in slots 0-2 from the key after
+    // the cursor, claiming and marking the nodes expired by now into the batch and unlinking
+    // marked ones as locate() does. Stops when the budget is used up or the batch is full,
+    // leaving the cursor at the last unexpired key passed, or at the end of the list, clearing
+    // the cursor and returning true. Restarts from the cursor when an unlink fails.
+    bool sweepExpired(Ticks now, unsigned int budget, unsigned int& numOfVisited, PopBatch& batch, int hzCellIndex) {
+        Node<T>* preds[heightLimit];
+        Node<T>* succs[heightLimit];
+        bool mark;
+        Node<T>* pred;
+        Node<T>* curr;
+        Node<T>* succ;
+        int predSlot, currSlot, succSlot;
+
+    retry:
+        pred = head;
+        if(expiryCursor) {
+            curr = locate(*expiryCursor, preds, succs, hzCellIndex);
+            pred = isEqual(curr, *expiryCursor) ? curr : preds[0];
+        }
+        predSlot = 0;
+        currSlot = 1;
+        succSlot = 2;
+        // still protected by locate() in slot 4 or 5
+        hazardDomain->protect(pred, hzCellIndex, predSlot);
+        curr = hazardDomain->protect(pred->nexts[0], mark, hzCellIndex, currSlot);
+        while (!mark && curr != tail) {
+            if(numOfVisited == budget || batch.count == PopBatch::capacity) {
+                moveExpiryCursor(pred);
+                return false;
             }
-            for (int j = 0; j <= p->level; ++j) {
-                if(p->nexts[j].getRef() != tail) {
-                    std::cout << p->nexts[j].getRef()->value << "[" << p->nexts[j].getMark() << "]\t";
-                } else {
-                    std::cout << "n[0]\t";
+            succ = hazardDomain->protect(curr->nexts[0], mark, hzCellIndex, succSlot);
+            if(!mark && curr->claimExpired(now)) {
+                ++numOfVisited;
+                if(markRemoved(curr, hzCellIndex)) {
+                    addToBatch(curr, batch, hzCellIndex);
                 }
+                // marked now, unlinked on the next round
+                continue;
             }
-            std::cout << std::endl;
+            if(mark) {
+                if(!pred->nexts[0].CAS(curr, succ, false, false)) {
+                    SKIPLIST_STAT(statsOf(hzCellIndex).casFailures[0].add());
+                    break;
+                }
+                curr = hazardDomain->protect(pred->nexts[0], mark, hzCellIndex, currSlot);
+                continue;
+            }
+            ++numOfVisited;
+            pred = curr;
+            curr = succ;
+            int freeSlot = predSlot;
+            predSlot = currSlot;
+            currSlot = succSlot;
+            succSlot = freeSlot;
+        }
+        if(curr != tail) {
+            // pred got removed or changed under the unlink
+            moveExpiryCursor(pred);
+            goto retry;
         }
+        expiryCursor.reset();
+        return true;
     }
 
-    void checkForLockFree() {
-        for(Node<T>* curr = head; curr != tail; curr = curr->nexts[0].getRef()) {
-            std::cout << "Node " << curr->value << ":" << std::endl;
-            checkNodeForLockFree(curr);
+    void moveExpiryCursor(Node<T>* node) {
+        if(node == head) {
+            expiryCursor.reset();
+        } else {
+            expiryCursor = node->value;
         }
     }
 
-// PRIVATE METHODS
-private:
+    // One search per node, in key order and from the fingers of the previous one, unlinks
+    // what is left of the towers before they are retired
+    void flushPops(PopBatch& batch, int hzCellIndex) {
+        Node<T>* preds[heightLimit];
+        Node<T>* succs[heightLimit];
+        std::sort(batch.nodes, batch.nodes + batch.count, [this](Node<T>* a, Node<T>* b) { return isLess(a->value, b->value); });
+        for (unsigned int i = 0; i < batch.count; ++i) {
+            Node<T>* node = batch.nodes[i];
+            find(node->value, preds, succs, hzCellIndex, i > 0 ? eachFinger : noFingers);
+            if(isMirrored && node->level >= 1) {
+                mirror->removed(node->level);
+            }
+            hazardDomain->deletePtr(node, hzCellIndex);
+        }
+        batch.count = 0;
+    }
+
+    SizeCounters& countersOf(int cellIndex) {
+        unsigned int size;
+        while ((size = sizeCounters->size()) <= cellIndex) {
+            sizeCounters->grow(size, [](void* memory) { new (memory) SizeCounters(); });
+        }
+        return *sizeCounters->get(cellIndex);
+    }
+
+    // numOfTowers[lvl] = nodes reaching lvl, summed over the cells without stopping them; the
+    // result is exact only when no update is running. Returns the number of levels filled.
+    int countTowers(double* numOfTowers) {
+        int numOfLevels = topLevel.load(std::memory_order_acquire) + 1;
+        for (int lvl = 0; lvl < numOfLevels; ++lvl) {
+            numOfTowers[lvl] = 0;
+        }
+        long long sum = 0;
+        for (int lvl = (int)maxHeight - 1; lvl >= 0; --lvl) {
+            for (unsigned int i = 0; i < sizeCounters->size(); ++i) {
+                sum += sizeCounters->get(i)->numOfNodes[lvl].load(std::memory_order_relaxed);
+            }
+            if(lvl < numOfLevels) {
+                numOfTowers[lvl] = sum > 0 ? (double)sum : 0;
+            }
+        }
+        return numOfLevels;
+    }
+
+    // The highest level with at least rankSampleSize towers, or 0
+    int sampleLevel(const double* numOfTowers, int numOfLevels) {
+        int lvl = numOfLevels - 1;
+        while (lvl > 0 && numOfTowers[lvl] < rankSampleSize) {
+            --lvl;
+        }
+        return lvl;
+    }
+
+    // Average number of keys from one tower of lvl to the next
+    static double widthOf(int lvl, const double* numOfTowers) {
+        return lvl == 0 || numOfTowers[lvl] <= 0 ? 1.0 : numOfTowers[0] / numOfTowers[lvl];
+    }
+
+    // Hand-over-hand descent from head on levels startLvl to 0 in slots 0-2 that moves right
+    // while canHop(lvl, next node) agrees. Removed nodes are unlinked as in locate(), and when
+    // that fails it calls restart() and starts over. Returns the last node it moved to on
+    // level 0, or head, protected until the next traversal in the cell.
+    template <class F, class R> Node<T>* descend(int startLvl, int hzCellIndex, F canHop, R restart) {
+        bool mark;
+        Node<T>* pred;
+        Node<T>* curr;
+        Node<T>* succ;
+        int predSlot, currSlot, succSlot;
+
+    retry:
+        pred = head;
+        predSlot = 0;
+        currSlot = 1;
+        succSlot = 2;
+        for (int lvl = startLvl; lvl >= 0; --lvl) {
+            curr = hazardDomain->protect(pred->nexts[lvl], mark, hzCellIndex, currSlot);
+            if(mark) {
+                helpRemove(pred, hzCellIndex);
+                restart();
+                goto retry;
+            }
+            while (curr != tail) {
+                succ = hazardDomain->protect(curr->nexts[lvl], mark, hzCellIndex, succSlot);
+                if(mark) {
+                    if(!pred->nexts[lvl].CAS(curr, succ, false, false)) {
+                        restart();
+                        goto retry;
+                    }
+                    curr = hazardDomain->protect(pred->nexts[lvl], mark, hzCellIndex, currSlot);
+                    if(mark) {
+                        helpRemove(pred, hzCellIndex);
+                        restart();
+                        goto retry;
+                    }
+                    continue;
+                }
+                if(!canHop(lvl, curr)) {
+                    break;
+                }
+                pred = curr;
+                curr = succ;
+                int freeSlot = predSlot;
+                predSlot = currSlot;
+                currSlot = succSlot;
+                succSlot = freeSlot;
+            }
+        }
+        return pred;
+    }
+
+    PopBatch& popBatchOf(int cellIndex) {
+        unsigned int size;
+        while ((size = popBatches->size()) <= cellIndex) {
+            popBatches->grow(size, [](void* memory) { new (memory) PopBatch(); });
+        }
+        return *popBatches->get(cellIndex);
+    }
+
+    // Walks the level to mirror hand over hand in slots 0-2 and refills the mirror. Gives up
+    // on a removed node that can't be unlinked, the next search tries again.
+    void rebuildMirror(int hzCellIndex) {
+        unsigned int lvl;
+        if(!mirror->beginRebuild(lvl)) {
+            return;
+        }
+        bool mark;
+        bool isComplete = true;
+        int predSlot = 0;
+        int currSlot = 1;
+        int succSlot = 2;
+        Node<T>* pred = head;
+        Node<T>* curr = hazardDomain->protect(pred->nexts[lvl], mark, hzCellIndex, currSlot);
+        while (isComplete && curr != tail) {
+            Node<T>* succ = hazardDomain->protect(curr->nexts[lvl], mark, hzCellIndex, succSlot);
+            if(mark) {
+                isComplete = pred->nexts[lvl].CAS(curr, succ, false, false);
+                curr = hazardDomain->protect(pred->nexts[lvl], mark, hzCellIndex, currSlot);
+                isComplete = isComplete && !mark;
+                continue;
+            }
+            isComplete = mirror->add(curr->value, curr);
+            pred = curr;
+            curr = succ;
+            int freeSlot = predSlot;
+            predSlot = currSlot;
+            currSlot = succSlot;
+            succSlot = freeSlot;
+        }
+        mirror->endRebuild(isComplete);
+    }
+
+    template <class K> Iterator makeIterator(const K* value, bool strict) {
+        int hzCellIndex = hazardDomain->acquireCell();
+        Node<T>* node = seek(value, strict, hzCellIndex);
+        if(node == tail) {
+            hazardDomain->releaseCell(hzCellIndex);
+            hzCellIndex = -1;
+        }
+        return Iterator(this, node, hzCellIndex);
+    }
+
+    template <class It> std::vector<T> sortedBatch(It begin, It end) {
+        std::vector<T> values(begin, end);
+        std::sort(values.begin(), values.end(), [this](const T& a, const T& b) { return isLess(a, b); });
+        // sorted, so a and b are equal unless a < b
+        values.erase(std::unique(values.begin(), values.end(), [this](const T& a, const T& b) { return !isLess(a, b); }),
+                     values.end());
+        return values;
+    }
+
+#ifdef SKIPLIST_STATS
+    OperationStats& statsOf(int cellIndex) {
+        unsigned int size;
+        while ((size = operationStats->size()) <= cellIndex) {
+            operationStats->grow(size, [](void* memory) { new (memory) OperationStats(); });
+        }
+        return *operationStats->get(cellIndex);
+    }
+#endif
+
+    // A new tower goes at most one level above topLevel and raises it before the tower is
+    // searched for, so the searches of its insert and of its remove start high enough
     unsigned int getRandomLevel() {
-        unsigned int lvl = 0;
-        std::mt19937 mt(randomDevice());
-        std::uniform_real_distribution<double> dist(0.0, 1.0);
-        while (dist(mt) < P && lvl < maxHeight-1) {
-            ++lvl;
+        unsigned int lvl = levelGenerator.next();
+        int top = topLevel.load(std::memory_order_relaxed);
+        if((int)lvl > top) {
+            lvl = top + 1;
+            while (top < (int)lvl && !topLevel.compare_exchange_weak(top, (int)lvl, std::memory_order_seq_cst)) {
+            }
         }
         return lvl;
     }
 
-    int compare(Node<T>* node, T other) {
-        if (node == tail) return 1;
-        if (node->value < other) return -1;
-        if (node->value == other) return 0;
-        return 1;
+    template <class A, class B> bool isLess(const A& a, const B& b) {
+        return isNegative(comparator(a, b));
+    }
+
+    // node is the first one with key >= value, as locate() returns it
+    template <class K> bool isEqual(Node<T>* node, const K& value) {
+        return node != tail && !isLess(value, node->value);
+    }
+
+    static bool isNegative(bool isLess) {
+        return isLess;
+    }
+
+    template <class R> static bool isNegative(R order) {
+        return order < 0;
     }
 
     void checkNodeForLockFree(Node<T>* node){
@@ -285,3 +1903,5 @@ private:
         }
     }
 };
+
+#endif //CONCURRENT_LOCKFREE_SKIPLIST_H
@@ -0,0 +1,169 @@
+#ifndef CONCURRENT_LOCKFREE_SKIPLIST_MAP_H
+#define CONCURRENT_LOCKFREE_SKIPLIST_MAP_H
+
+#include <chrono>
+#include <type_traits>
+#include "concurrent_lockfree_skiplist.h"
+
+// Values live inline in the nodes and are replaced atomically, so V must be trivially copyable.
+// Store a pointer or an index for bigger payloads.
+template <class K, class V, template <class, class> class Reclaimer = HazardDomain, class Compare = std::less<K>, class Clock = void>
+class ConcurrentSkipListMap : protected ConcurrentSkipList<K, Reclaimer, V, Compare, Clock> {
+    static_assert(std::is_trivially_copyable<V>::value, "ConcurrentSkipListMap value must be trivially copyable");
+
+    typedef ConcurrentSkipList<K, Reclaimer, V, Compare, Clock> Base;
+    typedef typename Base::template Node<K> MapNode;
+
+public:
+    // Iterates over keys, use get() or rangeScan() to read values.
+    typedef typename Base::Iterator Iterator;
+    typedef typename Base::ThreadHandle ThreadHandle;
+
+// CONSTRUCTORS
+public:
+    explicit ConcurrentSkipListMap(unsigned int maxHeight = Base::defaultMaxHeight, unsigned int maxNumOfThreads = 8, double P = 0.7,
+                                   const Compare& comparator = Compare())
+            : Base(maxHeight, maxNumOfThreads, P, comparator) {}
+
+// PUBLIC METHODS
+public:
+    using Base::contains;
+    using Base::remove;
+    using Base::checkForLockFree;
+    using Base::attach;
+#ifdef SKIPLIST_STATS
+    using Base::stats;
+#endif
+    using Base::begin;
+    using Base::end;
+    using Base::lowerBound;
+    using Base::upperBound;
+    using Base::ceiling;
+    using Base::floor;
+    using Base::size;
+    using Base::rank;
+    using Base::select;
+    using Base::saveSnapshot;
+    using Base::loadSnapshot;
+    using Base::enableChangeFeed;
+    using Base::expireAfter;
+    using Base::expireSome;
+
+    bool get(const K& key, V& value) {
+        return get<K>(key, value);
+    }
+
+    template <class Q, class = typename Base::template IfKey<Q>> bool get(const Q& key, V& value) {
+        int hzCellIndex = this->hazardDomain->acquireCell();
+        MapNode* node = this->search(key, hzCellIndex);
+        if(node != nullptr) {
+            value = node->mapped.load(std::memory_order_acquire);
+        }
+        this->hazardDomain->releaseCell(hzCellIndex);
+        return node != nullptr;
+    }
+
+    // Returns true if key was inserted, false if the value of an existing key was replaced.
+    bool put(const K& key, V value) {
+        bool inserted;
+        int hzCellIndex = this->hazardDomain->acquireCell();
+        while(true) {
+            MapNode* node = this->insert(key, inserted, hzCellIndex, value);
+            if(inserted) {
+                break;
+            }
+            node->mapped.store(value, std::memory_order_release);
+            // a concurrent remove may have marked the node before the store, retry on a fresh one
+            if(this->isPresent(node)) {
+                break;
+            }
+        }
+        this->hazardDomain->releaseCell(hzCellIndex);
+        return inserted;
+    }
+
+    // put() of a key that expires ttl from now, see ConcurrentSkipList::add(value, ttl). A
+    // present key takes the new value and deadline.
+    template <class Rep, class Period> bool put(const K& key, V value, std::chrono::duration<Rep, Period> ttl) {
+        static_assert(ExpiryTime<Clock>::isExpiring, "expiring keys need a map with a Clock");
+        typename ExpiryTime<Clock>::Ticks deadline = ExpiryTime<Clock>::after(ttl);
+        bool inserted;
+        int hzCellIndex = this->hazardDomain->acquireCell();
+        while(true) {
+            MapNode* node = this->insert(key, inserted, hzCellIndex, value);
+            if(inserted) {
+                node->expireAt(deadline);
+                break;
+            }
+            // fails if the key expired after the insert found it, the next insert removes it
+            if(!node->extend(ExpiryTime<Clock>::now(), deadline)) {
+                continue;
+            }
+            node->mapped.store(value, std::memory_order_release);
+            if(this->isPresent(node)) {
+                break;
+            }
+        }
+        this->hazardDomain->releaseCell(hzCellIndex);
+        return inserted;
+    }
+
+    bool putIfAbsent(const K& key, V value) {
+        bool inserted;
+        int hzCellIndex = this->hazardDomain->acquireCell();
+        this->insert(key, inserted, hzCellIndex, value);
+        this->hazardDomain->releaseCell(hzCellIndex);
+        return inserted;
+    }
+
+    bool putIfAbsent(const K& key, V value, V& current) {
+        bool inserted;
+        int hzCellIndex = this->hazardDomain->acquireCell();
+        MapNode* node = this->insert(key, inserted, hzCellIndex, value);
+        current = inserted ? value : node->mapped.load(std::memory_order_acquire);
+        this->hazardDomain->releaseCell(hzCellIndex);
+        return inserted;
+    }
+
+    // remapping(const V* old) gets nullptr if key is absent and returns the value to store.
+    // It may be called more than once under contention, so it must not have side effects.
+    template <class F> V compute(const K& key, F remapping) {
+        bool inserted;
+        V newValue;
+        int hzCellIndex = this->hazardDomain->acquireCell();
+        while(true) {
+            MapNode* node = this->search(key, hzCellIndex);
+            if(node == nullptr) {
+                newValue = remapping(static_cast<const V*>(nullptr));
+                node = this->insert(key, inserted, hzCellIndex, newValue);
+                if(inserted) {
+                    break;
+                }
+            }
+            V oldValue = node->mapped.load(std::memory_order_acquire);
+            newValue = remapping(&oldValue);
+            while(!node->mapped.compare_exchange_weak(oldValue, newValue,
+                                                      std::memory_order_acq_rel, std::memory_order_acquire)) {
+                newValue = remapping(&oldValue);
+            }
+            if(this->isPresent(node)) {
+                break;
+            }
+        }
+        this->hazardDomain->releaseCell(hzCellIndex);
+        return newValue;
+    }
+
+    // Calls callback(key, value) for every key in [lo, hi] in ascending order, returns the number of calls.
+    template <class F> int rangeScan(const K& lo, const K& hi, F callback) {
+        return this->scan(lo, hi, [&callback](MapNode* node) { callback(node->value, node->mapped.load(std::memory_order_acquire)); });
+    }
+
+    void print() {
+        for (MapNode *p = this->head->nexts[0].getRef(); p != this->tail; p = p->nexts[0].getRef()) {
+            std::cout << p->value << " -> " << p->mapped.load(std::memory_order_relaxed) << "\t[" << p->nexts[0].getMark() << "]" << std::endl;
+        }
+    }
+};
+
+#endif //CONCURRENT_LOCKFREE_SKIPLIST_MAP_H
@@ -0,0 +1,591 @@
+#ifndef CONCURRENT_UNROLLED_SKIPLIST_H
+#define CONCURRENT_UNROLLED_SKIPLIST_H
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <vector>
+#include "atomic_markable_reference.h"
+#include "cell_array.h"
+#include "epoch_domain.h"
+#include "hazard_domain.h"
+#include "key_search.h"
+#include "level_generator.h"
+#include "node_pool.h"
+
+// Keys per chunk by default: as many as fit in one cache line next to the 16-byte block header
+template <class T> struct ChunkCapacity {
+    static const unsigned int value = (cacheLineSize - 16) / sizeof(T) >= 2 ? (cacheLineSize - 16) / sizeof(T) : 2;
+};
+
+// Unrolled skip list: level 0 is a list of chunks holding up to K sorted keys each, and the index
+// levels above link the chunks by their lower bound. A chunk's keys and its level 0 link live in
+// an immutable block that is replaced with one CAS on every change (copy-on-write), so adding a
+// key, removing one, splitting a full chunk and unlinking an emptied one are all single-CAS updates.
+// A chunk owns the keys from its low up to the low of the next live chunk. Removing the last key
+// of a chunk swaps in a dead block instead: the dead chunk's range passes to the live chunk before
+// it, and traversals that pass by unlink it. Chunks are never merged otherwise.
+// Blocks and chunks are retired through Reclaimer, chunks keep their last block with them.
+template <class T, unsigned int K = ChunkCapacity<T>::value, template <class, class> class Reclaimer = HazardDomain>
+class ConcurrentUnrolledSkipList {
+    static_assert(K >= 2 && K <= 0xFFFF, "ConcurrentUnrolledSkipList needs 2 to 65535 keys per chunk");
+
+    class Chunk;
+
+    // common base of chunks and blocks, so one domain retires both
+    class Piece {
+    public:
+        bool isChunk;
+    };
+
+    class Block : public Piece {
+    public:
+        bool isDead;
+        unsigned short count;
+        Chunk* next;    // level 0 successor, nullptr at the end
+        T keys[K];
+
+        static Block* create(unsigned int count, Chunk* next, bool isDead = false) {
+            return new (NodePool<Block>::allocate(0, sizeof(Block))) Block(count, next, isDead);
+        }
+
+        // keys[0, count) of from, with another successor
+        static Block* copy(const Block* from, Chunk* next) {
+            Block* block = create(from->count, next);
+            std::copy(from->keys, from->keys + from->count, block->keys);
+            return block;
+        }
+
+        static void destroy(Block* block) {
+            block->~Block();
+            NodePool<Block>::deallocate(block, 0);
+        }
+
+    private:
+        Block(unsigned int count, Chunk* next, bool isDead) {
+            this->isChunk = false;
+            this->isDead = isDead;
+            this->count = (unsigned short)count;
+            this->next = next;
+        }
+    };
+
+    // The index tower runs past the end of the object like a node's: links[lvl-1] is the
+    // link on index level lvl, for lvl in [1, level].
+    class Chunk : public Piece {
+    public:
+        T low;
+        unsigned int level;
+        std::atomic<Block*> block;
+        AtomicMarkableReference<Chunk> links[1];
+
+        static Chunk* create(T low, unsigned int lvl, Block* block) {
+            std::size_t size = sizeof(Chunk) + (lvl > 1 ? lvl-1 : 0)*sizeof(AtomicMarkableReference<Chunk>);
+            return new (NodePool<Chunk>::allocate(lvl, size)) Chunk(low, lvl, block);
+        }
+
+        static void destroy(Chunk* chunk) {
+            unsigned int lvl = chunk->level;
+            Block::destroy(chunk->block.load(std::memory_order_relaxed));
+            chunk->~Chunk();
+            NodePool<Chunk>::deallocate(chunk, lvl);
+        }
+
+        AtomicMarkableReference<Chunk>& link(unsigned int lvl) {
+            return links[lvl-1];
+        }
+
+    private:
+        Chunk(T low, unsigned int lvl, Block* block) : block(block) {
+            this->isChunk = true;
+            this->low = low;
+            level = lvl;
+            for (unsigned int i = 1; i < level; ++i) {
+                new (&links[i]) AtomicMarkableReference<Chunk>();
+            }
+        }
+    };
+
+    struct PieceDeleter {
+        void operator()(Piece* piece) const {
+            if(piece->isChunk) {
+                Chunk::destroy(static_cast<Chunk*>(piece));
+            } else {
+                Block::destroy(static_cast<Block*>(piece));
+            }
+        }
+    };
+
+    // A chunk and the block it had when it was read, protected in slots slot and slot+1
+    struct Position {
+        Chunk* chunk;
+        Block* block;
+        int slot;
+    };
+
+public:
+    static const unsigned int heightLimit = NodePool<Chunk>::maxNumOfClasses;
+
+    // Keeps a reclamation cell bound to the thread that called attach(), see ConcurrentSkipList
+    class ThreadHandle {
+        friend class ConcurrentUnrolledSkipList;
+
+        ConcurrentUnrolledSkipList* list;
+
+        explicit ThreadHandle(ConcurrentUnrolledSkipList* list) {
+            this->list = list;
+        }
+
+    public:
+        ThreadHandle(ThreadHandle&& other) noexcept {
+            list = other.list;
+            other.list = nullptr;
+        }
+
+        ThreadHandle(const ThreadHandle&) = delete;
+        ThreadHandle& operator=(const ThreadHandle&) = delete;
+
+        ~ThreadHandle() {
+            if(list != nullptr) {
+                list->hazardDomain->detachThread();
+            }
+        }
+    };
+
+// FIELDS
+private:
+    // 0-2 - index traversal, rotating hand over hand
+    // 3-6 - level 0 walk, chunk and block in 3 and 4 or in 5 and 6
+    // 7 - chunk being linked into the index or removed
+    // 2*lvl+6 and 2*lvl+7 - pred and succ of index level lvl >= 1
+    static const int chunkSlot = 7;
+
+    unsigned int maxHeight;     // index levels are 1 to maxHeight-1
+
+    LevelGenerator levelGenerator;
+
+    Reclaimer<Piece, PieceDeleter>* hazardDomain;
+
+    // never dies, its low stands for minus infinity
+    Chunk* head;
+
+// CONSTRUCTORS
+public:
+    explicit ConcurrentUnrolledSkipList(unsigned int maxHeight = 20, unsigned int maxNumOfThreads = 8, double P = 0.5) {
+        this->maxHeight = maxHeight < heightLimit ? maxHeight : heightLimit;
+        levelGenerator = LevelGenerator(P, this->maxHeight-1);
+        head = Chunk::create(T(), this->maxHeight-1, Block::create(0, nullptr));
+        for (unsigned int lvl = 1; lvl < this->maxHeight; ++lvl) {
+            head->link(lvl).setVal(nullptr, false, std::memory_order_relaxed);
+        }
+        hazardDomain = new Reclaimer<Piece, PieceDeleter>(2*this->maxHeight+6, maxNumOfThreads);
+    }
+
+//DESTRUCTOR
+    ~ConcurrentUnrolledSkipList() {
+        Chunk* toDel;
+        for (Chunk* p = head; p != nullptr;) {
+            toDel = p;
+            p = p->block.load(std::memory_order_relaxed)->next;
+            Chunk::destroy(toDel);
+        }
+        delete hazardDomain;
+    }
+
+// PUBLIC METHODS
+public:
+    bool contains(T value) {
+        Position pos;
+        int hzCellIndex = hazardDomain->acquireCell();
+        locate(value, nullptr, nullptr, pos, hzCellIndex);
+        unsigned int i = KeySearch<T>::countLess(pos.block->keys, pos.block->count, value);
+        bool result = i < pos.block->count && !(value < pos.block->keys[i]);
+        hazardDomain->releaseCell(hzCellIndex);
+        return result;
+    }
+
+    bool add(T value) {
+        Chunk* preds[heightLimit];
+        Chunk* succs[heightLimit];
+        Position pos;
+        int hzCellIndex = hazardDomain->acquireCell();
+        while (true) {
+            locate(value, preds, succs, pos, hzCellIndex);
+            Block* block = pos.block;
+            unsigned int i = KeySearch<T>::countLess(block->keys, block->count, value);
+            if(i < block->count && !(value < block->keys[i])) {
+                hazardDomain->releaseCell(hzCellIndex);
+                return false;
+            }
+
+            Block* updated;
+            Chunk* sibling = nullptr;
+            if(block->count < K) {
+                updated = Block::create(block->count + 1, block->next);
+                std::copy(block->keys, block->keys + i, updated->keys);
+                updated->keys[i] = value;
+                std::copy(block->keys + i, block->keys + block->count, updated->keys + i + 1);
+            } else {
+                // full: the upper half moves to a new chunk linked right after this one
+                T merged[K + 1];
+                std::copy(block->keys, block->keys + i, merged);
+                merged[i] = value;
+                std::copy(block->keys + i, block->keys + K, merged + i + 1);
+                unsigned int half = (K + 1) / 2;
+                Block* upper = Block::create(K + 1 - half, block->next);
+                std::copy(merged + half, merged + K + 1, upper->keys);
+                sibling = Chunk::create(merged[half], getRandomLevel(), upper);
+                for (unsigned int lvl = 1; lvl <= sibling->level; ++lvl) {
+                    sibling->link(lvl).setVal(succs[lvl], false, std::memory_order_relaxed);
+                }
+                hazardDomain->protect(sibling, hzCellIndex, chunkSlot);
+                updated = Block::create(half, sibling);
+                std::copy(merged, merged + half, updated->keys);
+            }
+
+            Block* expected = block;
+            if(!pos.chunk->block.compare_exchange_strong(expected, updated, std::memory_order_acq_rel)) {
+                Block::destroy(updated);
+                if(sibling != nullptr) {
+                    Chunk::destroy(sibling);
+                }
+                continue;
+            }
+            // linearization point
+            hazardDomain->deletePtr(block, hzCellIndex);
+            if(sibling != nullptr) {
+                linkTower(sibling, preds, succs, hzCellIndex);
+            }
+            hazardDomain->releaseCell(hzCellIndex);
+            return true;
+        }
+    }
+
+    bool remove(T value) {
+        Position pos;
+        int hzCellIndex = hazardDomain->acquireCell();
+        while (true) {
+            locate(value, nullptr, nullptr, pos, hzCellIndex);
+            Block* block = pos.block;
+            unsigned int i = KeySearch<T>::countLess(block->keys, block->count, value);
+            if(i == block->count || value < block->keys[i]) {
+                hazardDomain->releaseCell(hzCellIndex);
+                return false;
+            }
+
+            Block* updated;
+            bool isEmptied = block->count == 1 && pos.chunk != head;
+            if(isEmptied) {
+                updated = Block::create(0, block->next, true);
+            } else {
+                updated = Block::create(block->count - 1, block->next);
+                std::copy(block->keys, block->keys + i, updated->keys);
+                std::copy(block->keys + i + 1, block->keys + block->count, updated->keys + i);
+            }
+
+            Block* expected = block;
+            if(!pos.chunk->block.compare_exchange_strong(expected, updated, std::memory_order_acq_rel)) {
+                Block::destroy(updated);
+                continue;
+            }
+            // linearization point
+            hazardDomain->deletePtr(block, hzCellIndex);
+            if(isEmptied) {
+                removeChunk(pos.chunk, hzCellIndex);
+            }
+            hazardDomain->releaseCell(hzCellIndex);
+            return true;
+        }
+    }
+
+    template <class It> int insertBatch(It begin, It end) {
+        int numOfInserted = 0;
+        for (It it = begin; it != end; ++it) {
+            numOfInserted += add(*it);
+        }
+        return numOfInserted;
+    }
+
+    // Calls callback(key) for every key in [lo, hi] in ascending order, returns the number of calls.
+    // Weakly consistent like ConcurrentSkipList::rangeScan(), every chunk is read as one snapshot.
+    template <class F> int rangeScan(T lo, T hi, F callback) {
+        int count = 0;
+        bool hasLast = false;
+        T last = lo;
+        Position pos;
+        int hzCellIndex = hazardDomain->acquireCell();
+        locate(lo, nullptr, nullptr, pos, hzCellIndex);
+        while (true) {
+            Block* block = pos.block;
+            unsigned int i = KeySearch<T>::countLess(block->keys, block->count, lo);
+            for (; i < block->count && !(hi < block->keys[i]); ++i) {
+                if(!hasLast || last < block->keys[i]) {
+                    last = block->keys[i];
+                    hasLast = true;
+                    callback(last);
+                    ++count;
+                }
+            }
+            if(i < block->count) {
+                break;
+            }
+
+            int nextSlot = pos.slot == 3 ? 5 : 3;
+            Chunk* next = block->next;
+            hazardDomain->protect(next, hzCellIndex, nextSlot);
+            if(pos.chunk->block.load(std::memory_order_seq_cst) != block) {
+                // changed after it was read, carry on from the owner of the last key seen
+                locate(last, nullptr, nullptr, pos, hzCellIndex);
+                continue;
+            }
+            if(next == nullptr || hi < next->low) {
+                break;
+            }
+            Block* nextBlock = protectBlock(next, hzCellIndex, nextSlot + 1);
+            if(nextBlock->isDead) {
+                // its range belongs to pos.chunk now, locate() unlinks it on the way
+                locate(next->low, nullptr, nullptr, pos, hzCellIndex);
+                continue;
+            }
+            pos.chunk = next;
+            pos.block = nextBlock;
+            pos.slot = nextSlot;
+        }
+        hazardDomain->releaseCell(hzCellIndex);
+        return count;
+    }
+
+    // auto handle = list.attach(); at the start of a worker thread
+    ThreadHandle attach() {
+        hazardDomain->attachThread();
+        return ThreadHandle(this);
+    }
+
+    void print() {
+        int i = 0;
+        for (Chunk* p = head; p != nullptr;) {
+            Block* block = p->block.load(std::memory_order_acquire);
+            if(p == head) {
+                std::cout << i++ << ".\th [" << p->level << "]\t";
+            } else {
+                std::cout << i++ << ".\t" << p->low << " [" << p->level << "]\t";
+            }
+            for (unsigned int j = 0; j < block->count; ++j) {
+                std::cout << block->keys[j] << ' ';
+            }
+            std::cout << (block->isDead ? "dead" : "") << std::endl;
+            p = block->next;
+        }
+    }
+
+    // Chunks at level 0, call it only while no other thread is using the list
+    unsigned int getNumOfChunks() {
+        unsigned int result = 0;
+        for (Chunk* p = head; p != nullptr; p = p->block.load(std::memory_order_acquire)->next) {
+            ++result;
+        }
+        return result;
+    }
+
+    unsigned long long getNumOfRetiredPieces() {
+        return hazardDomain->getNumOfRetired();
+    }
+
+    unsigned long long getNumOfFreedPieces() {
+        return hazardDomain->getNumOfFreed();
+    }
+
+// PRIVATE METHODS
+private:
+    // Finds the owner of value: the last live chunk with low <= value, with the block it had
+    // when it was read, which is the linearization point of the caller. If preds/succs are given
+    // they are filled with the index neighbours of value and protected in slots 2*lvl+6 and 2*lvl+7.
+    void locate(const T& value, Chunk** preds, Chunk** succs, Position& pos, int hzCellIndex) {
+        while (true) {
+            Chunk* start = indexLocate(value, preds, succs, hzCellIndex);
+            Chunk* dead = walk(value, start, pos, hzCellIndex);
+            if(dead == nullptr) {
+                return;
+            }
+            // emptied but maybe still in the index, help taking it out
+            markTower(dead);
+        }
+    }
+
+    // Index part of locate(): hand-over-hand search like ConcurrentSkipList::locate() for the last
+    // chunk with low <= value on every index level, unlinking chunks with marked links on the way.
+    // Returns the level 1 pred, protected in slots 0-2.
+    Chunk* indexLocate(const T& value, Chunk** preds, Chunk** succs, int hzCellIndex) {
+        bool mark;
+        Chunk* pred;
+        Chunk* curr;
+        Chunk* succ;
+        int predSlot, currSlot, succSlot;
+
+    retry:
+        pred = head;
+        predSlot = 0;
+        currSlot = 1;
+        succSlot = 2;
+        for (unsigned int lvl = maxHeight-1; lvl >= 1; --lvl) {
+            curr = protectLink(pred->link(lvl), mark, hzCellIndex, currSlot);
+            if(mark) {
+                goto retry;
+            }
+            while (curr != nullptr) {
+                succ = protectLink(curr->link(lvl), mark, hzCellIndex, succSlot);
+                if(mark) {
+                    if(!pred->link(lvl).CAS(curr, succ, false, false)) {
+                        goto retry;
+                    }
+                    curr = protectLink(pred->link(lvl), mark, hzCellIndex, currSlot);
+                    if(mark) {
+                        goto retry;
+                    }
+                    continue;
+                }
+                if(value < curr->low) {
+                    break;
+                }
+                pred = curr;
+                curr = succ;
+                int freeSlot = predSlot;
+                predSlot = currSlot;
+                currSlot = succSlot;
+                succSlot = freeSlot;
+            }
+
+            if(preds != nullptr) {
+                hazardDomain->reprotect(pred, hzCellIndex, 2 * lvl + 6);
+                hazardDomain->reprotect(curr, hzCellIndex, 2 * lvl + 7);
+                preds[lvl] = pred;
+                succs[lvl] = curr;
+            }
+        }
+        return pred;
+    }
+
+    // Level 0 part of locate(): walks from start, a protected chunk with low <= value, to the
+    // owner of value and unlinks the dead chunks it passes. Returns nullptr with the owner in
+    // pos, or a chunk found dead on the way if the search has to start over.
+    Chunk* walk(const T& value, Chunk* start, Position& pos, int hzCellIndex) {
+        int nextSlot = 5;
+        pos.chunk = start;
+        pos.slot = 3;
+        hazardDomain->reprotect(start, hzCellIndex, pos.slot);
+        pos.block = protectBlock(start, hzCellIndex, pos.slot + 1);
+        while (true) {
+            if(pos.block->isDead) {
+                return pos.chunk;
+            }
+            Chunk* next = pos.block->next;
+            hazardDomain->protect(next, hzCellIndex, nextSlot);
+            // next is still linked, so not retired, as long as the block is still the chunk's
+            if(pos.chunk->block.load(std::memory_order_seq_cst) != pos.block) {
+                pos.block = protectBlock(pos.chunk, hzCellIndex, pos.slot + 1);
+                continue;
+            }
+            if(next == nullptr || value < next->low) {
+                return nullptr;
+            }
+            Block* nextBlock = protectBlock(next, hzCellIndex, nextSlot + 1);
+            if(!nextBlock->isDead) {
+                pos.chunk = next;
+                pos.block = nextBlock;
+                std::swap(pos.slot, nextSlot);
+                continue;
+            }
+            // next has been emptied and its range belongs to pos.chunk already
+            Block* unlinked = Block::copy(pos.block, nextBlock->next);
+            Block* expected = pos.block;
+            if(pos.chunk->block.compare_exchange_strong(expected, unlinked, std::memory_order_acq_rel)) {
+                hazardDomain->deletePtr(pos.block, hzCellIndex);
+            } else {
+                Block::destroy(unlinked);
+            }
+            pos.block = protectBlock(pos.chunk, hzCellIndex, pos.slot + 1);
+        }
+    }
+
+    // Links a chunk made by a split into the index. preds and succs come from the search for the
+    // key that caused the split and surround the new chunk too. The chunk is protected in chunkSlot.
+    void linkTower(Chunk* chunk, Chunk** preds, Chunk** succs, int hzCellIndex) {
+        bool isLinking = true;
+        for (unsigned int lvl = 1; isLinking && lvl <= chunk->level; ++lvl) {
+            while (true) {
+                Chunk* succ = succs[lvl];
+                // a refind may have moved the successor of any level still to be linked, point
+                // the chunk at it first; its links are marked once it has been emptied
+                bool mark;
+                Chunk* next = chunk->link(lvl).getRefAndMark(mark);
+                if(mark || (next != succ && !chunk->link(lvl).CAS(next, succ, false, false))) {
+                    isLinking = false;
+                    break;
+                }
+                if(preds[lvl]->link(lvl).CAS(succ, chunk, false, false)) {
+                    break;
+                }
+                indexLocate(chunk->low, preds, succs, hzCellIndex);
+            }
+        }
+        // emptied while the tower was being linked: the remover may have missed some levels
+        if(protectBlock(chunk, hzCellIndex, 4)->isDead) {
+            markTower(chunk);
+            indexLocate(chunk->low, nullptr, nullptr, hzCellIndex);
+        }
+    }
+
+    // The chunk's block has just been replaced by a dead one: take it out of the index and of
+    // level 0, then retire it
+    void removeChunk(Chunk* chunk, int hzCellIndex) {
+        Position pos;
+        hazardDomain->reprotect(chunk, hzCellIndex, chunkSlot);
+        markTower(chunk);
+        locate(chunk->low, nullptr, nullptr, pos, hzCellIndex);
+        hazardDomain->deletePtr(chunk, hzCellIndex);
+    }
+
+    // Marks the index links of a dead chunk top-down, so the index searches unlink it
+    void markTower(Chunk* chunk) {
+        bool mark;
+        for (unsigned int lvl = chunk->level; lvl >= 1; --lvl) {
+            Chunk* succ = chunk->link(lvl).getRefAndMark(mark);
+            while (!mark) {
+                chunk->link(lvl).weakCAS(succ, succ, false, true);
+                succ = chunk->link(lvl).getRefAndMark(mark);
+            }
+        }
+    }
+
+    // Publishes the target of link and re-reads link until it didn't change meanwhile
+    Chunk* protectLink(AtomicMarkableReference<Chunk>& link, bool& mark, int hzCellIndex, int refIndex) {
+        Chunk* chunk = link.getRefAndMark(mark);
+        while (true) {
+            hazardDomain->protect(chunk, hzCellIndex, refIndex);
+            Chunk* reloaded = link.getRefAndMark(mark, std::memory_order_seq_cst);
+            if(reloaded == chunk) {
+                return chunk;
+            }
+            chunk = reloaded;
+        }
+    }
+
+    // Same for the block of a protected chunk
+    Block* protectBlock(Chunk* chunk, int hzCellIndex, int refIndex) {
+        Block* block = chunk->block.load(std::memory_order_acquire);
+        while (true) {
+            hazardDomain->protect(block, hzCellIndex, refIndex);
+            Block* reloaded = chunk->block.load(std::memory_order_seq_cst);
+            if(reloaded == block) {
+                return block;
+            }
+            block = reloaded;
+        }
+    }
+
+    unsigned int getRandomLevel() {
+        return levelGenerator.next();
+    }
+};
+
+#endif //CONCURRENT_UNROLLED_SKIPLIST_H
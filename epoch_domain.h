@@ -0,0 +1,264 @@
+#ifndef EPOCH_DOMAIN_H
+#define EPOCH_DOMAIN_H
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "atomic_markable_reference.h"
+#include "cell_array.h"
+#include "skiplist_stats.h"
+
+// Epoch-based reclamation with the same cell interface as HazardDomain. A thread holding a
+// cell announces the global epoch once on acquireCell(), so protect() is free. A pointer
+// retired in epoch e is freed once the global epoch reaches e+2, which happens only after
+// every cell that was active in epoch e has been released or has caught up. A cell attached
+// to a thread stays claimed between operations but is inactive and doesn't hold epochs back.
+template<class T, class Deleter = std::default_delete<T>> class EpochDomain {
+    template<class E> class EpochCell {
+    public:
+        std::atomic<bool> isFree{true};
+        // 2*epoch+1 while inside an operation, 0 otherwise
+        std::atomic<unsigned long long> announcement{0};
+
+        // limbo lists of the last three epochs, indexed by epoch%3
+        std::vector<E*> retiredRefs[3];
+        unsigned long long retiredEpochs[3] = {0, 0, 0};
+        unsigned int numOfRetiresSinceAdvance = 0;
+
+        std::atomic<unsigned long long> numOfRetired{0};
+        std::atomic<unsigned long long> numOfFreed{0};
+
+#ifdef SKIPLIST_STATS
+        std::vector<unsigned long long> retiredAts[3];    // parallel to retiredRefs
+        ReclamationStats stats;
+#endif
+    };
+
+    // retires per cell between attempts to move the global epoch forward
+    static const unsigned int advanceInterval = 64;
+
+private:
+    std::atomic<unsigned long long> globalEpoch{0};
+
+    // maxNumOfThreads cells up front, more are added when all of them are taken
+    CellArray<EpochCell<T>>* cells;
+
+    Deleter deleter;
+
+public:
+    // numOfSafeRefs is unused, it keeps the constructor interchangeable with HazardDomain
+    explicit EpochDomain(unsigned int numOfSafeRefs = 45, unsigned int maxNumOfThreads = 8, Deleter deleter = Deleter()) {
+        this->deleter = deleter;
+        cells = new CellArray<EpochCell<T>>(maxNumOfThreads, [](void* memory) { new (memory) EpochCell<T>(); });
+    }
+
+    ~EpochDomain() {
+        for (int i = 0; i < cells->size(); ++i) {
+            for (int j = 0; j < 3; ++j) {
+                for (T* p : cells->get(i)->retiredRefs[j]) {
+                    deleter(p);
+                }
+            }
+        }
+        delete cells;
+    }
+
+    // The calling thread's attached cell if it has one and isn't using it, otherwise any free cell
+    int acquireCell() {
+        int cellIndex = -1;
+        ThreadBindings& bindings = ThreadBindings::local();
+        if(!bindings.isEmpty()) {
+            ThreadBindings::Binding* binding = bindings.find(this);
+            if(binding != nullptr && !binding->isInUse) {
+                binding->isInUse = true;
+                cellIndex = binding->cellIndex;
+            }
+        }
+        if(cellIndex < 0) {
+            cellIndex = claimCell();
+        }
+        cells->get(cellIndex)->announcement.store(2*globalEpoch.load(std::memory_order_acquire) + 1, std::memory_order_relaxed);
+        // the announcement must be visible before any node is read
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return cellIndex;
+    }
+
+    void releaseCell(int cellIndex) {
+        cells->get(cellIndex)->announcement.store(0, std::memory_order_release);
+        ThreadBindings& bindings = ThreadBindings::local();
+        if(!bindings.isEmpty()) {
+            ThreadBindings::Binding* binding = bindings.find(this);
+            if(binding != nullptr && binding->cellIndex == cellIndex) {
+                binding->isInUse = false;
+                return;
+            }
+        }
+        cells->get(cellIndex)->isFree.store(true, std::memory_order_release);
+    }
+
+    // Binds a cell to the calling thread until the matching detachThread()
+    void attachThread() {
+        ThreadBindings& bindings = ThreadBindings::local();
+        ThreadBindings::Binding* binding = bindings.find(this);
+        if(binding != nullptr) {
+            ++binding->numOfAttaches;
+            return;
+        }
+        int cellIndex = claimCell();
+        if(bindings.add(this, cellIndex) == nullptr) {
+            // too many domains attached to this thread, it keeps acquiring cells per operation
+            cells->get(cellIndex)->isFree.store(true, std::memory_order_release);
+        }
+    }
+
+    void detachThread() {
+        ThreadBindings& bindings = ThreadBindings::local();
+        ThreadBindings::Binding* binding = bindings.find(this);
+        if(binding == nullptr || --binding->numOfAttaches > 0) {
+            return;
+        }
+        int cellIndex = binding->cellIndex;
+        bindings.remove(this);
+        cells->get(cellIndex)->isFree.store(true, std::memory_order_release);
+    }
+
+    T* protect(AtomicMarkableReference<T>& src, bool& mark, int cellIndex, int refIndex) {
+        return src.getRefAndMark(mark);
+    }
+
+    T* protect(T* ptr, int cellIndex, int refIndex) {
+        return ptr;
+    }
+
+    T* reprotect(T* ptr, int cellIndex, int refIndex) {
+        return ptr;
+    }
+
+    // Nothing stays protected past the operation that read it
+    bool isProtected(T* ptr, int cellIndex, int refIndex) {
+        return false;
+    }
+
+    void deletePtr(T* ptr, int cellIndex) {
+        EpochCell<T>* cell = cells->get(cellIndex);
+        // ptr is already unlinked, read the epoch only after that
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        unsigned long long epoch = globalEpoch.load(std::memory_order_acquire);
+        int bag = epoch%3;
+        if(cell->retiredEpochs[bag] != epoch) {
+            // the bag holds pointers retired three or more epochs ago
+            freeBag(cell, bag);
+            cell->retiredEpochs[bag] = epoch;
+        }
+        cell->retiredRefs[bag].push_back(ptr);
+        SKIPLIST_STAT(cell->retiredAts[bag].push_back(statsNow()));
+        cell->numOfRetired.store(cell->numOfRetired.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+        if(++cell->numOfRetiresSinceAdvance >= advanceInterval) {
+            cell->numOfRetiresSinceAdvance = 0;
+            tryAdvance();
+            unsigned long long current = globalEpoch.load(std::memory_order_acquire);
+            for (int i = 0; i < 3; ++i) {
+                if(cell->retiredEpochs[i] + 2 <= current) {
+                    freeBag(cell, i);
+                }
+            }
+        }
+    }
+
+    // Returns once every cell that was inside an operation when it was called has been
+    // released: the epoch has to move forward twice, and the second step waits for cells
+    // still announcing an epoch from before the call. The caller must not hold a cell.
+    void synchronize() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        unsigned long long target = globalEpoch.load(std::memory_order_acquire) + 2;
+        while (globalEpoch.load(std::memory_order_acquire) < target) {
+            if(!tryAdvance()) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    unsigned long long getNumOfRetired() {
+        unsigned long long result = 0;
+        for (int i = 0; i < cells->size(); ++i) {
+            result += cells->get(i)->numOfRetired.load(std::memory_order_relaxed);
+        }
+        return result;
+    }
+
+    unsigned long long getNumOfFreed() {
+        unsigned long long result = 0;
+        for (int i = 0; i < cells->size(); ++i) {
+            result += cells->get(i)->numOfFreed.load(std::memory_order_relaxed);
+        }
+        return result;
+    }
+
+    unsigned long long getNumOfPending() {
+        return getNumOfRetired() - getNumOfFreed();
+    }
+
+#ifdef SKIPLIST_STATS
+    void collectStats(SkipListStats& stats) {
+        for (int i = 0; i < cells->size(); ++i) {
+            cells->get(i)->stats.collect(stats);
+        }
+    }
+#endif
+
+private:
+    int claimCell() {
+        bool cellIsFree;
+        while(true) {
+            unsigned int numOfCells = cells->size();
+            unsigned int first = ThreadBindings::hint()%numOfCells;
+            for (unsigned int j = 0; j < numOfCells; ++j) {
+                EpochCell<T>* cell = cells->get((first+j)%numOfCells);
+                cellIsFree = cell->isFree.load(std::memory_order_relaxed);
+                if(cellIsFree && cell->isFree.compare_exchange_strong(cellIsFree, false,
+                                                                      std::memory_order_acquire, std::memory_order_relaxed)) {
+                    return (first+j)%numOfCells;
+                }
+            }
+            if(!cells->grow(numOfCells, [](void* memory) { new (memory) EpochCell<T>(); })) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    bool tryAdvance() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        unsigned long long current = globalEpoch.load(std::memory_order_acquire);
+        for (int i = 0; i < cells->size(); ++i) {
+            unsigned long long announcement = cells->get(i)->announcement.load(std::memory_order_acquire);
+            if(announcement != 0 && announcement != 2*current + 1) {
+                return false;
+            }
+        }
+        return globalEpoch.compare_exchange_strong(current, current+1, std::memory_order_acq_rel);
+    }
+
+    void freeBag(EpochCell<T>* cell, int bag) {
+#ifdef SKIPLIST_STATS
+        if(!cell->retiredRefs[bag].empty()) {
+            cell->stats.numOfScans.add();
+            cell->stats.numOfScannedRefs.add(cell->retiredRefs[bag].size());
+            unsigned long long now = statsNow();
+            for (unsigned long long retiredAt : cell->retiredAts[bag]) {
+                cell->stats.reclaimed(retiredAt, now);
+            }
+            cell->retiredAts[bag].clear();
+        }
+#endif
+        for (T* p : cell->retiredRefs[bag]) {
+            deleter(p);
+        }
+        cell->numOfFreed.store(cell->numOfFreed.load(std::memory_order_relaxed) + cell->retiredRefs[bag].size(),
+                               std::memory_order_relaxed);
+        cell->retiredRefs[bag].clear();
+    }
+};
+
+#endif //EPOCH_DOMAIN_H
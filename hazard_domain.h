@@ -1,160 +1,277 @@
+#ifndef HAZARD_DOMAIN_H
+#define HAZARD_DOMAIN_H
+
+#include <algorithm>
 #include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "atomic_markable_reference.h"
+#include "cell_array.h"
+#include "skiplist_stats.h"
 
-template<class T> class HazardDomain {
+template<class T, class Deleter = std::default_delete<T>> class HazardDomain {
+    // The first line holds what the owner and claiming threads touch, the safe refs start on
+    // a line of their own and run past the end of the object, see size().
     template<class E> class HazardCell {
     public:
-        // 0 - pred
-        // 1 - curr
-        // 2 - succ
-        // 3 - newNode/toRemove
-        // 4-(numOfRefs-1) - preds and succs
+        std::atomic<bool> isFree{true};
 
-        int currentToDeleteIndex;
+        // retired by the thread holding the cell, not freed yet
+        std::vector<E*> retiredRefs;
 
-        std::atomic<bool> isFree{true};
-        std::atomic<E*>* safeRefs;
-        std::atomic<E*>* deleteRefs;
+        std::atomic<unsigned long long> numOfRetired{0};
+        std::atomic<unsigned long long> numOfFreed{0};
 
-        explicit HazardCell(int numOfSafeRefs, int numOfDeleteRefs) {
-            currentToDeleteIndex = 0;
-            safeRefs = new std::atomic<E*>[numOfSafeRefs]{nullptr};
-            deleteRefs = new std::atomic<E*>[numOfDeleteRefs]{nullptr};
+#ifdef SKIPLIST_STATS
+        std::vector<unsigned long long> retiredAts;    // parallel to retiredRefs
+        ReclamationStats stats;
+#endif
+
+        // 0-2 - pred, curr and succ of a traversal, rotating hand over hand
+        // 3 - newNode/toRemove/iterator position
+        // 4-(numOfRefs-1) - preds and succs
+        alignas(cacheLineSize) std::atomic<E*> safeRefs[1];
+
+        explicit HazardCell(int numOfSafeRefs) {
+            for (int i = 0; i < numOfSafeRefs; ++i) {
+                new (&safeRefs[i]) std::atomic<E*>(nullptr);
+            }
         }
 
-        ~HazardCell(){
-            delete[] safeRefs;
-            delete[] deleteRefs;
+        static std::size_t size(int numOfSafeRefs) {
+            return sizeof(HazardCell) + (numOfSafeRefs - 1)*sizeof(std::atomic<E*>);
         }
     };
 
-private:
-    unsigned int numOfCells;
+    // A scan frees at least numOfRetiredRefs - numOfCells*numOfSafeRefsPerCell nodes, so with
+    // R = scanFactor*H*N retired refs per scan at least half of them go and each retire
+    // costs O(1) amortized. N is the current number of cells.
+    static const unsigned int scanFactor = 2;
 
+private:
     unsigned int numOfSafeRefsPerCell;
-    unsigned int numOfDeleteRefsPerCell;
 
-    HazardCell<T>** cells;
+    // maxNumOfThreads cells up front, more are added when all of them are taken
+    CellArray<HazardCell<T>>* cells;
+
+    Deleter deleter;
 
 public:
-    explicit HazardDomain(unsigned int numOfSafeRefs = 45, unsigned int maxNumOfThreads = 8) {
-        numOfCells = maxNumOfThreads;
+    explicit HazardDomain(unsigned int numOfSafeRefs = 45, unsigned int maxNumOfThreads = 8, Deleter deleter = Deleter()) {
+        this->deleter = deleter;
         numOfSafeRefsPerCell = numOfSafeRefs;
-        numOfDeleteRefsPerCell = (unsigned int)1.5*numOfSafeRefs*maxNumOfThreads;
-
-        cells = new HazardCell<T>*[numOfCells];
-        for (int i = 0; i < numOfCells; ++i) {
-            cells[i] = new HazardCell<T>(numOfSafeRefsPerCell, numOfDeleteRefsPerCell);
-        }
+        cells = new CellArray<HazardCell<T>>(maxNumOfThreads, HazardCell<T>::size(numOfSafeRefs),
+                                             [numOfSafeRefs](void* memory) { new (memory) HazardCell<T>(numOfSafeRefs); });
     }
 
     ~HazardDomain() {
-        T* p;
-        for (int i = numOfCells-1; i >= 0; i = --numOfCells-1) {
-            for (int j = 0; j < numOfDeleteRefsPerCell; ++j) {
-                p = cells[i]->deleteRefs[j].load();
-                if(p != nullptr) {
-                    wipeToDeleteRef(p);
-                    delete p;
-                }
+        for (int i = 0; i < cells->size(); ++i) {
+            for (T* p : cells->get(i)->retiredRefs) {
+                deleter(p);
             }
-            delete cells[i];
         }
-        delete[] cells;
+        delete cells;
     }
 
+    // The calling thread's attached cell if it has one and isn't using it, otherwise any free cell
     int acquireCell() {
-        bool cellIsFree;
-        int i = 0;
-        while(true) {
-            cellIsFree = cells[i]->isFree.load();
-            if(cellIsFree && cells[i]->isFree.compare_exchange_strong(cellIsFree, false)) {
-                break;
+        ThreadBindings& bindings = ThreadBindings::local();
+        if(!bindings.isEmpty()) {
+            ThreadBindings::Binding* binding = bindings.find(this);
+            if(binding != nullptr && !binding->isInUse) {
+                binding->isInUse = true;
+                return binding->cellIndex;
             }
-            i = (i+1)%numOfCells;
         }
-        return i;
+        return claimCell();
     }
 
+    // An attached cell keeps its hazards until its thread's next operation overwrites them
     void releaseCell(int cellIndex) {
-        for (int i = 0; i < numOfSafeRefsPerCell; ++i) {
-            cells[cellIndex]->safeRefs[i].store(nullptr);
+        ThreadBindings& bindings = ThreadBindings::local();
+        if(!bindings.isEmpty()) {
+            ThreadBindings::Binding* binding = bindings.find(this);
+            if(binding != nullptr && binding->cellIndex == cellIndex) {
+                binding->isInUse = false;
+                return;
+            }
+        }
+        freeCell(cellIndex);
+    }
+
+    // Binds a cell to the calling thread until the matching detachThread()
+    void attachThread() {
+        ThreadBindings& bindings = ThreadBindings::local();
+        ThreadBindings::Binding* binding = bindings.find(this);
+        if(binding != nullptr) {
+            ++binding->numOfAttaches;
+            return;
+        }
+        int cellIndex = claimCell();
+        if(bindings.add(this, cellIndex) == nullptr) {
+            // too many domains attached to this thread, it keeps acquiring cells per operation
+            freeCell(cellIndex);
+        }
+    }
+
+    void detachThread() {
+        ThreadBindings& bindings = ThreadBindings::local();
+        ThreadBindings::Binding* binding = bindings.find(this);
+        if(binding == nullptr || --binding->numOfAttaches > 0) {
+            return;
+        }
+        int cellIndex = binding->cellIndex;
+        bindings.remove(this);
+        freeCell(cellIndex);
+    }
+
+    // Publishes the reference held by src and re-reads src until it didn't change meanwhile.
+    // If src belongs to a protected node and mark comes back false, the returned node was
+    // still linked after the publication and won't be freed before the slot is overwritten.
+    // seq_cst: the publication must be ordered before the re-read.
+    T* protect(AtomicMarkableReference<T>& src, bool& mark, int cellIndex, int refIndex) {
+        std::atomic<T*>& safeRef = cells->get(cellIndex)->safeRefs[refIndex];
+        T* ptr = src.getRefAndMark(mark);
+        while(true) {
+            safeRef.store(ptr, std::memory_order_seq_cst);
+            T* reloaded = src.getRefAndMark(mark, std::memory_order_seq_cst);
+            if(reloaded == ptr) {
+                return ptr;
+            }
+            ptr = reloaded;
         }
-        cells[cellIndex]->isFree.store(true);
     }
 
+    // For pointers that are already protected in another slot or not shared yet
     T* protect(T* ptr, int cellIndex, int refIndex) {
-        cells[cellIndex]->safeRefs[refIndex].store(ptr);
+        cells->get(cellIndex)->safeRefs[refIndex].store(ptr, std::memory_order_seq_cst);
         return ptr;
     }
 
-    void deletePtr(T* ptr, int hzExceptCellIndex) {
-        int currIndex = cells[hzExceptCellIndex]->currentToDeleteIndex;
-        T* p = cells[hzExceptCellIndex]->deleteRefs[currIndex].load();
-        if(p == nullptr) {
-            cells[hzExceptCellIndex]->deleteRefs[currIndex].store(ptr);
-        } else {
-            while(true) {
-                if (!containsPtrExcept(p, hzExceptCellIndex)) {
-                    cells[hzExceptCellIndex]->deleteRefs[currIndex].store(ptr);
-                    delete p;
-                    break;
-                }
-                currIndex = (currIndex+1)%numOfDeleteRefsPerCell;
-                p = cells[hzExceptCellIndex]->deleteRefs[currIndex].load();
-            }
+    // protect() that skips the store when the slot already holds ptr
+    T* reprotect(T* ptr, int cellIndex, int refIndex) {
+        std::atomic<T*>& safeRef = cells->get(cellIndex)->safeRefs[refIndex];
+        if(safeRef.load(std::memory_order_relaxed) != ptr) {
+            safeRef.store(ptr, std::memory_order_seq_cst);
+        }
+        return ptr;
+    }
+
+    // Whether the slot still holds ptr, e.g. from an earlier operation of an attached thread
+    bool isProtected(T* ptr, int cellIndex, int refIndex) {
+        return cells->get(cellIndex)->safeRefs[refIndex].load(std::memory_order_relaxed) == ptr;
+    }
+
+    void deletePtr(T* ptr, int hzCellIndex) {
+        HazardCell<T>* cell = cells->get(hzCellIndex);
+        cell->retiredRefs.push_back(ptr);
+        SKIPLIST_STAT(cell->retiredAts.push_back(statsNow()));
+        cell->numOfRetired.store(cell->numOfRetired.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        if(cell->retiredRefs.size() >= scanFactor*numOfSafeRefsPerCell*cells->size()) {
+            scan(hzCellIndex);
+        }
+    }
+
+    unsigned long long getNumOfRetired() {
+        unsigned long long result = 0;
+        for (int i = 0; i < cells->size(); ++i) {
+            result += cells->get(i)->numOfRetired.load(std::memory_order_relaxed);
         }
-        currIndex = (currIndex+1)%numOfDeleteRefsPerCell;
-        cells[hzExceptCellIndex]->currentToDeleteIndex = currIndex;
+        return result;
     }
 
+    unsigned long long getNumOfFreed() {
+        unsigned long long result = 0;
+        for (int i = 0; i < cells->size(); ++i) {
+            result += cells->get(i)->numOfFreed.load(std::memory_order_relaxed);
+        }
+        return result;
+    }
+
+    // retired but still waiting for a scan
+    unsigned long long getNumOfPending() {
+        return getNumOfRetired() - getNumOfFreed();
+    }
+
+#ifdef SKIPLIST_STATS
+    void collectStats(SkipListStats& stats) {
+        for (int i = 0; i < cells->size(); ++i) {
+            cells->get(i)->stats.collect(stats);
+        }
+    }
+#endif
+
 private:
-    bool containsPtrExcept(T* ptr, int hzExceptCellIndex) {
-        for (int i = 0; i < numOfCells; ++i) {
-            if(i != hzExceptCellIndex && !cells[i]->isFree.load()) {
-                for (int j = 0; j < numOfSafeRefsPerCell; ++j) {
-                    if(cells[i]->safeRefs[j].load() == ptr) {
-                        return true;
-                    }
+    int claimCell() {
+        bool cellIsFree;
+        while(true) {
+            unsigned int numOfCells = cells->size();
+            unsigned int first = ThreadBindings::hint()%numOfCells;
+            for (unsigned int j = 0; j < numOfCells; ++j) {
+                HazardCell<T>* cell = cells->get((first+j)%numOfCells);
+                cellIsFree = cell->isFree.load(std::memory_order_relaxed);
+                if(cellIsFree && cell->isFree.compare_exchange_strong(cellIsFree, false,
+                                                                      std::memory_order_acquire, std::memory_order_relaxed)) {
+                    return (first+j)%numOfCells;
                 }
             }
+            unsigned int numOfSafeRefs = numOfSafeRefsPerCell;
+            if(!cells->grow(numOfCells, [numOfSafeRefs](void* memory) { new (memory) HazardCell<T>(numOfSafeRefs); })) {
+                std::this_thread::yield();
+            }
         }
-        return false;
     }
 
-    void wipeToDeleteRef(T* ptr) {
-        T* p;
-        for (int i = 0; i < numOfCells; ++i) {
-            for (int j = 0; j < numOfDeleteRefsPerCell; ++j) {
-                p = cells[i]->deleteRefs[j].load();
-                if(p == ptr) {
-                    cells[i]->deleteRefs[j].store(nullptr);
-                }
-            }
+    void freeCell(int cellIndex) {
+        HazardCell<T>* cell = cells->get(cellIndex);
+        for (int i = 0; i < numOfSafeRefsPerCell; ++i) {
+            cell->safeRefs[i].store(nullptr, std::memory_order_release);
         }
+        cell->isFree.store(true, std::memory_order_release);
     }
 
-//UNUSED
-    /*void deletePtr(T* ptr, int hzExceptCellIndex) {
-        if(!putToDeleteRefs(ptr, hzExceptCellIndex)) {
-            T* p;
-            for (int i = 0; i < numOfDeleteRefsPerCell; ++i) {
-                p = cells[hzExceptCellIndex]->deleteRefs[i].load();
-                if(!containsPtrExcept(p, hzExceptCellIndex)) {
-                    cells[hzExceptCellIndex]->deleteRefs[i].store(nullptr);
-                    delete p;
+    // Snapshots the hazard pointers of all cells once, then frees every retired pointer of
+    // the cell that is not in the snapshot. The cell's own slots count too, an attached
+    // thread may keep using what they protect in its next operation.
+    void scan(int hzCellIndex) {
+        unsigned int numOfCells = cells->size();
+        std::vector<T*> hazards;
+        hazards.reserve(numOfCells*numOfSafeRefsPerCell);
+        // pairs with the seq_cst publication in protect(): the retired pointers are already
+        // unlinked, so a hazard published after this point fails its validation
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        for (int i = 0; i < numOfCells; ++i) {
+            for (int j = 0; j < numOfSafeRefsPerCell; ++j) {
+                T* p = cells->get(i)->safeRefs[j].load(std::memory_order_acquire);
+                if(p != nullptr) {
+                    hazards.push_back(p);
                 }
             }
-            putToDeleteRefs(ptr, hzExceptCellIndex);
         }
-    }*/
+        std::sort(hazards.begin(), hazards.end());
 
-    bool putToDeleteRefs(T *ptr, int cellIndex) {
-        for (int i = 0; i < numOfDeleteRefsPerCell; ++i) {
-            if(cells[cellIndex]->deleteRefs[i].load() == nullptr) {
-                cells[cellIndex]->deleteRefs[i].store(ptr);
-                return true;
+        HazardCell<T>* cell = cells->get(hzCellIndex);
+        SKIPLIST_STAT(cell->stats.numOfScans.add());
+        SKIPLIST_STAT(cell->stats.numOfScannedRefs.add(cell->retiredRefs.size()));
+        SKIPLIST_STAT(cell->stats.numOfScannedHazards.add(hazards.size()));
+        SKIPLIST_STAT(unsigned long long now = statsNow());
+        unsigned int numOfKept = 0;
+        for (unsigned int i = 0; i < cell->retiredRefs.size(); ++i) {
+            T* p = cell->retiredRefs[i];
+            if(std::binary_search(hazards.begin(), hazards.end(), p)) {
+                SKIPLIST_STAT(cell->retiredAts[numOfKept] = cell->retiredAts[i]);
+                cell->retiredRefs[numOfKept++] = p;
+            } else {
+                SKIPLIST_STAT(cell->stats.reclaimed(cell->retiredAts[i], now));
+                deleter(p);
             }
         }
-        return false;
+        SKIPLIST_STAT(cell->retiredAts.resize(numOfKept));
+        cell->numOfFreed.store(cell->numOfFreed.load(std::memory_order_relaxed) + cell->retiredRefs.size() - numOfKept,
+                               std::memory_order_relaxed);
+        cell->retiredRefs.resize(numOfKept);
     }
 };
+
+#endif //HAZARD_DOMAIN_H
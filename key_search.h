@@ -0,0 +1,91 @@
+#ifndef KEY_SEARCH_H
+#define KEY_SEARCH_H
+
+#include <cstdint>
+#include <type_traits>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// KeySearch<T>::countLess(keys, n, key): number of keys in the sorted keys[0, n) that are less
+// than key, i.e. the index of the first key >= key. Meant for short arrays such as a chunk of
+// an unrolled list. 32- and 64-bit integers compare a whole vector of keys at a time (AVX2,
+// or SSE2, and SSE4.2 for 64-bit keys), other types scan with operator<.
+template <class T, class Enable = void> struct KeySearch {
+    static unsigned int countLess(const T* keys, unsigned int n, const T& key) {
+        unsigned int i = 0;
+        while (i < n && keys[i] < key) {
+            ++i;
+        }
+        return i;
+    }
+};
+
+inline unsigned int countBits(unsigned int x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned int)__builtin_popcount(x);
+#else
+    unsigned int n = 0;
+    for (; x != 0; x &= x - 1) {
+        ++n;
+    }
+    return n;
+#endif
+}
+
+// Unsigned keys are compared as signed ones with the sign bit flipped on both sides
+template <class T> struct KeySearch<T, typename std::enable_if<std::is_integral<T>::value && sizeof(T) == 4>::type> {
+    static unsigned int countLess(const T* keys, unsigned int n, T key) {
+        unsigned int i = 0;
+        unsigned int count = 0;
+#if defined(__AVX2__)
+        const __m256i flip8 = _mm256_set1_epi32(std::is_signed<T>::value ? 0 : INT32_MIN);
+        const __m256i key8 = _mm256_xor_si256(_mm256_set1_epi32((int32_t)key), flip8);
+        for (; i + 8 <= n; i += 8) {
+            __m256i v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(keys + i)), flip8);
+            count += countBits((unsigned int)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(key8, v))));
+        }
+#endif
+#if defined(__SSE2__)
+        const __m128i flip4 = _mm_set1_epi32(std::is_signed<T>::value ? 0 : INT32_MIN);
+        const __m128i key4 = _mm_xor_si128(_mm_set1_epi32((int32_t)key), flip4);
+        for (; i + 4 <= n; i += 4) {
+            __m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(keys + i)), flip4);
+            count += countBits((unsigned int)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(key4, v))));
+        }
+#endif
+        for (; i < n; ++i) {
+            count += keys[i] < key;
+        }
+        return count;
+    }
+};
+
+template <class T> struct KeySearch<T, typename std::enable_if<std::is_integral<T>::value && sizeof(T) == 8>::type> {
+    static unsigned int countLess(const T* keys, unsigned int n, T key) {
+        unsigned int i = 0;
+        unsigned int count = 0;
+#if defined(__AVX2__)
+        const __m256i flip4 = _mm256_set1_epi64x(std::is_signed<T>::value ? 0 : INT64_MIN);
+        const __m256i key4 = _mm256_xor_si256(_mm256_set1_epi64x((int64_t)key), flip4);
+        for (; i + 4 <= n; i += 4) {
+            __m256i v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(keys + i)), flip4);
+            count += countBits((unsigned int)_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(key4, v))));
+        }
+#endif
+#if defined(__SSE4_2__)
+        const __m128i flip2 = _mm_set1_epi64x(std::is_signed<T>::value ? 0 : INT64_MIN);
+        const __m128i key2 = _mm_xor_si128(_mm_set1_epi64x((int64_t)key), flip2);
+        for (; i + 2 <= n; i += 2) {
+            __m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(keys + i)), flip2);
+            count += countBits((unsigned int)_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(key2, v))));
+        }
+#endif
+        for (; i < n; ++i) {
+            count += keys[i] < key;
+        }
+        return count;
+    }
+};
+
+#endif //KEY_SEARCH_H
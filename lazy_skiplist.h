@@ -0,0 +1,262 @@
+#ifndef LAZY_SKIPLIST_H
+#define LAZY_SKIPLIST_H
+
+#include <atomic>
+#include <thread>
+#include "epoch_domain.h"
+#include "level_generator.h"
+#include "node_pool.h"
+
+// Lazy skip list (Herlihy, Lev, Luchangco, Shavit): add and remove lock the preds of the
+// affected levels and validate them optimistically, contains takes no locks. Removed nodes
+// are logically deleted by a flag first and unlinked under the locks afterwards. Kept as a
+// lock-based reference point for ConcurrentSkipList; memory is reclaimed with EpochDomain.
+template <class T> class LazySkipList {
+    class Node {
+    public:
+        T value;
+        unsigned int level;
+        std::atomic<bool> isLocked{false};
+        std::atomic<bool> isMarked{false};
+        std::atomic<bool> isFullyLinked{false};
+        std::atomic<Node*> nexts[1];
+
+        static Node* create(T value, unsigned int lvl) {
+            return new (NodePool<Node>::allocate(lvl, sizeof(Node) + lvl*sizeof(std::atomic<Node*>))) Node(value, lvl);
+        }
+
+        static void destroy(Node* node) {
+            unsigned int lvl = node->level;
+            node->~Node();
+            NodePool<Node>::deallocate(node, lvl);
+        }
+
+        void lock() {
+            while (isLocked.exchange(true, std::memory_order_acquire)) {
+                while (isLocked.load(std::memory_order_relaxed)) {
+                    std::this_thread::yield();
+                }
+            }
+        }
+
+        void unlock() {
+            isLocked.store(false, std::memory_order_release);
+        }
+
+    private:
+        Node(T value, unsigned int lvl) {
+            this->value = value;
+            level = lvl;
+            for (unsigned int i = 0; i <= level; ++i) {
+                new (&nexts[i]) std::atomic<Node*>(nullptr);
+            }
+        }
+    };
+
+    struct NodeDeleter {
+        void operator()(Node* node) const {
+            Node::destroy(node);
+        }
+    };
+
+    static const unsigned int heightLimit = NodePool<Node>::maxNumOfClasses;
+
+// FIELDS
+private:
+    unsigned int maxHeight;
+
+    LevelGenerator levelGenerator;
+
+    EpochDomain<Node, NodeDeleter>* epochDomain;
+
+    Node* head;
+    Node* tail;
+
+// CONSTRUCTORS
+public:
+    explicit LazySkipList(unsigned int maxHeight = 20, unsigned int maxNumOfThreads = 8, double P = 0.5) {
+        this->maxHeight = maxHeight < heightLimit ? maxHeight : heightLimit;
+        levelGenerator = LevelGenerator(P, this->maxHeight-1);
+        tail = Node::create(T(), this->maxHeight-1);
+        head = Node::create(T(), this->maxHeight-1);
+        for (int i = 0; i < this->maxHeight; ++i) {
+            head->nexts[i].store(tail, std::memory_order_relaxed);
+        }
+        head->isFullyLinked.store(true, std::memory_order_relaxed);
+        tail->isFullyLinked.store(true, std::memory_order_relaxed);
+        epochDomain = new EpochDomain<Node, NodeDeleter>(0, maxNumOfThreads);
+    }
+
+//DESTRUCTOR
+    ~LazySkipList() {
+        Node* toDel;
+        for (Node* p = head; p != tail;) {
+            toDel = p;
+            p = p->nexts[0].load(std::memory_order_relaxed);
+            Node::destroy(toDel);
+        }
+        Node::destroy(tail);
+        delete epochDomain;
+    }
+
+// PUBLIC METHODS
+public:
+    bool contains(T value) {
+        Node* preds[heightLimit];
+        Node* succs[heightLimit];
+        int cellIndex = epochDomain->acquireCell();
+        int lvlFound = find(value, preds, succs);
+        bool result = lvlFound != -1 && succs[lvlFound]->isFullyLinked.load(std::memory_order_acquire)
+                      && !succs[lvlFound]->isMarked.load(std::memory_order_acquire);
+        epochDomain->releaseCell(cellIndex);
+        return result;
+    }
+
+    bool add(T value) {
+        unsigned int topLvl = levelGenerator.next();
+        Node* preds[heightLimit];
+        Node* succs[heightLimit];
+        int cellIndex = epochDomain->acquireCell();
+        while (true) {
+            int lvlFound = find(value, preds, succs);
+            if(lvlFound != -1) {
+                Node* found = succs[lvlFound];
+                if(!found->isMarked.load(std::memory_order_acquire)) {
+                    while (!found->isFullyLinked.load(std::memory_order_acquire)) {
+                        std::this_thread::yield();
+                    }
+                    epochDomain->releaseCell(cellIndex);
+                    return false;
+                }
+                continue;
+            }
+
+            int highestLocked = -1;
+            bool isValid = true;
+            for (int lvl = 0; isValid && lvl <= topLvl; ++lvl) {
+                Node* pred = preds[lvl];
+                Node* succ = succs[lvl];
+                if(lvl == 0 || pred != preds[lvl-1]) {
+                    pred->lock();
+                }
+                highestLocked = lvl;
+                isValid = !pred->isMarked.load(std::memory_order_acquire) && !succ->isMarked.load(std::memory_order_acquire)
+                          && pred->nexts[lvl].load(std::memory_order_acquire) == succ;
+            }
+            if(!isValid) {
+                unlockPreds(preds, highestLocked);
+                continue;
+            }
+
+            Node* newNode = Node::create(value, topLvl);
+            for (int lvl = 0; lvl <= topLvl; ++lvl) {
+                newNode->nexts[lvl].store(succs[lvl], std::memory_order_relaxed);
+            }
+            for (int lvl = 0; lvl <= topLvl; ++lvl) {
+                preds[lvl]->nexts[lvl].store(newNode, std::memory_order_release);
+            }
+            // linearization point
+            newNode->isFullyLinked.store(true, std::memory_order_release);
+            unlockPreds(preds, highestLocked);
+            epochDomain->releaseCell(cellIndex);
+            return true;
+        }
+    }
+
+    bool remove(T value) {
+        Node* victim = nullptr;
+        bool isMarked = false;
+        int topLvl = -1;
+        Node* preds[heightLimit];
+        Node* succs[heightLimit];
+        int cellIndex = epochDomain->acquireCell();
+        while (true) {
+            int lvlFound = find(value, preds, succs);
+            if(lvlFound != -1) {
+                victim = succs[lvlFound];
+            }
+            if(!isMarked && (lvlFound == -1 || !victim->isFullyLinked.load(std::memory_order_acquire)
+                             || victim->level != lvlFound || victim->isMarked.load(std::memory_order_acquire))) {
+                epochDomain->releaseCell(cellIndex);
+                return false;
+            }
+
+            if(!isMarked) {
+                topLvl = victim->level;
+                victim->lock();
+                if(victim->isMarked.load(std::memory_order_relaxed)) {
+                    victim->unlock();
+                    epochDomain->releaseCell(cellIndex);
+                    return false;
+                }
+                // linearization point
+                victim->isMarked.store(true, std::memory_order_release);
+                isMarked = true;
+            }
+
+            int highestLocked = -1;
+            bool isValid = true;
+            for (int lvl = 0; isValid && lvl <= topLvl; ++lvl) {
+                Node* pred = preds[lvl];
+                if(lvl == 0 || pred != preds[lvl-1]) {
+                    pred->lock();
+                }
+                highestLocked = lvl;
+                isValid = !pred->isMarked.load(std::memory_order_acquire)
+                          && pred->nexts[lvl].load(std::memory_order_acquire) == victim;
+            }
+            if(!isValid) {
+                unlockPreds(preds, highestLocked);
+                continue;
+            }
+
+            for (int lvl = topLvl; lvl >= 0; --lvl) {
+                preds[lvl]->nexts[lvl].store(victim->nexts[lvl].load(std::memory_order_relaxed), std::memory_order_release);
+            }
+            victim->unlock();
+            unlockPreds(preds, highestLocked);
+            epochDomain->deletePtr(victim, cellIndex);
+            epochDomain->releaseCell(cellIndex);
+            return true;
+        }
+    }
+
+    template <class It> int insertBatch(It begin, It end) {
+        int numOfInserted = 0;
+        for (It it = begin; it != end; ++it) {
+            numOfInserted += add(*it);
+        }
+        return numOfInserted;
+    }
+
+// PRIVATE METHODS
+private:
+    // Highest level holding value, or -1. Fills preds/succs on every level without locking.
+    int find(T value, Node** preds, Node** succs) {
+        int lvlFound = -1;
+        Node* pred = head;
+        for (int lvl = maxHeight-1; lvl >= 0; --lvl) {
+            Node* curr = pred->nexts[lvl].load(std::memory_order_acquire);
+            while (curr != tail && curr->value < value) {
+                pred = curr;
+                curr = pred->nexts[lvl].load(std::memory_order_acquire);
+            }
+            if(lvlFound == -1 && curr != tail && curr->value == value) {
+                lvlFound = lvl;
+            }
+            preds[lvl] = pred;
+            succs[lvl] = curr;
+        }
+        return lvlFound;
+    }
+
+    void unlockPreds(Node** preds, int highestLocked) {
+        for (int lvl = 0; lvl <= highestLocked; ++lvl) {
+            if(lvl == 0 || preds[lvl] != preds[lvl-1]) {
+                preds[lvl]->unlock();
+            }
+        }
+    }
+};
+
+#endif //LAZY_SKIPLIST_H
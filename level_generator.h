@@ -0,0 +1,108 @@
+#ifndef LEVEL_GENERATOR_H
+#define LEVEL_GENERATOR_H
+
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <thread>
+
+// Draws tower levels with P(level >= l) = P^l from one 64-bit xorshift64* draw.
+// The generator state is thread local, so concurrent inserts share nothing but the
+// read-only thresholds. For P = 2^-k the level is ctz(draw)/k, otherwise it is the
+// number of precomputed thresholds P^i * 2^64 above the draw.
+class LevelGenerator {
+private:
+    static const unsigned int maxNumOfThresholds = 64;
+
+    unsigned int maxLevel;
+    unsigned int zerosPerLevel;
+    uint64_t thresholds[maxNumOfThresholds];
+    double P;
+    bool isLegacy;
+
+public:
+    explicit LevelGenerator(double P = 0.5, unsigned int maxLevel = 19) {
+        this->maxLevel = maxLevel < maxNumOfThresholds ? maxLevel : maxNumOfThresholds;
+        this->P = P;
+        isLegacy = false;
+        zerosPerLevel = 0;
+        for (unsigned int k = 1; k < 64; ++k) {
+            if(P == std::ldexp(1.0, -(int)k)) {
+                zerosPerLevel = k;
+                break;
+            }
+        }
+        long double threshold = 18446744073709551616.0L;
+        for (unsigned int i = 0; i < maxNumOfThresholds; ++i) {
+            threshold *= P;
+            thresholds[i] = threshold >= 18446744073709551615.0L ? UINT64_MAX : (uint64_t)threshold;
+        }
+    }
+
+    // The draw lists used before this generator, kept to measure against: a fresh mt19937 per
+    // level, seeded from a random_device all threads share
+    static LevelGenerator legacy(double P = 0.5, unsigned int maxLevel = 19) {
+        LevelGenerator generator(P, maxLevel);
+        generator.isLegacy = true;
+        return generator;
+    }
+
+    unsigned int next() const {
+        if(isLegacy) {
+            return legacyNext();
+        }
+        uint64_t r = draw();
+        unsigned int lvl;
+        if(zerosPerLevel != 0) {
+            lvl = countTrailingZeros(r | (1ull << 63)) / zerosPerLevel;
+        } else {
+            lvl = 0;
+            while (lvl < maxLevel && r < thresholds[lvl]) {
+                ++lvl;
+            }
+        }
+        return lvl < maxLevel ? lvl : maxLevel;
+    }
+
+    static uint64_t draw() {
+        static thread_local uint64_t state = seed();
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 0x2545F4914F6CDD1Dull;
+    }
+
+private:
+    unsigned int legacyNext() const {
+        static std::random_device randomDevice;
+        std::mt19937 mt(randomDevice());
+        std::uniform_real_distribution<double> dist(0.0, 1.0);
+        unsigned int lvl = 0;
+        while (lvl < maxLevel && dist(mt) < P) {
+            ++lvl;
+        }
+        return lvl;
+    }
+
+    static uint64_t seed() {
+        std::random_device randomDevice;
+        uint64_t s = ((uint64_t)randomDevice() << 32) ^ randomDevice();
+        s ^= std::hash<std::thread::id>()(std::this_thread::get_id()) * 0x9E3779B97F4A7C15ull;
+        return s != 0 ? s : 0x9E3779B97F4A7C15ull;
+    }
+
+    static unsigned int countTrailingZeros(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+        return (unsigned int)__builtin_ctzll(x);
+#else
+        unsigned int n = 0;
+        while ((x & 1) == 0) {
+            x >>= 1;
+            ++n;
+        }
+        return n;
+#endif
+    }
+};
+
+#endif //LEVEL_GENERATOR_H
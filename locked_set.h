@@ -0,0 +1,53 @@
+#ifndef LOCKED_SET_H
+#define LOCKED_SET_H
+
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <type_traits>
+
+// std::set behind a single lock, the baseline for the benchmarks. With std::shared_mutex
+// contains() takes the lock shared, with std::mutex every operation is exclusive.
+template <class T, class Mutex = std::mutex> class LockedSet {
+    typedef typename std::conditional<std::is_same<Mutex, std::shared_mutex>::value,
+                                      std::shared_lock<Mutex>, std::unique_lock<Mutex>>::type ReadLock;
+    typedef std::unique_lock<Mutex> WriteLock;
+
+// FIELDS
+private:
+    std::set<T> values;
+    Mutex mutex;
+
+// CONSTRUCTORS
+public:
+    // same parameters as ConcurrentSkipList so the benchmark can build either, all unused
+    explicit LockedSet(unsigned int maxHeight = 20, unsigned int maxNumOfThreads = 8, double P = 0.5) {}
+
+// PUBLIC METHODS
+public:
+    bool contains(T value) {
+        ReadLock lock(mutex);
+        return values.find(value) != values.end();
+    }
+
+    bool add(T value) {
+        WriteLock lock(mutex);
+        return values.insert(value).second;
+    }
+
+    bool remove(T value) {
+        WriteLock lock(mutex);
+        return values.erase(value) > 0;
+    }
+
+    template <class It> int insertBatch(It begin, It end) {
+        WriteLock lock(mutex);
+        int numOfInserted = 0;
+        for (It it = begin; it != end; ++it) {
+            numOfInserted += values.insert(*it).second;
+        }
+        return numOfInserted;
+    }
+};
+
+#endif //LOCKED_SET_H
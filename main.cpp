@@ -1,22 +1,21 @@
-#define _WIN32_WINNT 0x0501
+#include <chrono>
+#include <cstdio>
 #include <ctime>
+#include <cstdlib>
 #include <future>
 #include <thread>
-#include <mingw.thread.h>
 #include <fstream>
-#include <unistd.h>
+#include <vector>
+#include "benchmark.h"
 #include "concurrent_lockfree_skiplist.h"
+#include "concurrent_lockfree_skiplist_map.h"
+#include "concurrent_unrolled_skiplist.h"
+#include "lazy_skiplist.h"
+#include "locked_set.h"
+#include "partitioned_skiplist.h"
 
 using namespace std;
 
-std::random_device rd;
-
-void randInit(ConcurrentSkipList<int> *list) {
-    for(int i = 0; i < 3000; ++i) {
-        list->add((rd() % 2 ? -1 : 1) * (rd()%30000));
-    }
-}
-
 void notRandInit(ConcurrentSkipList<int> *list) {
     list->add(-2);
     list->add(7);
@@ -145,123 +144,508 @@ void repeatTest(int times) {
 }
 
 
+// Clock of the expiry checks, only moves when they move it
+struct CheckClock {
+    typedef long long rep;
+    typedef std::milli period;
+    typedef chrono::duration<rep, period> duration;
+    typedef chrono::time_point<CheckClock> time_point;
+    static const bool is_steady = true;
+
+    static long long ticks;
+
+    static time_point now() {
+        return time_point(duration(ticks));
+    }
+};
+
+long long CheckClock::ticks = 1000;
+
+bool check(bool condition, const char* what) {
+    if(!condition) {
+        cout << "FAILED: " << what << endl;
+    }
+    return condition;
+}
+
+template <class List> vector<int> keysOf(List& list) {
+    vector<int> keys;
+    for (typename List::Iterator it = list.begin(); it != list.end(); ++it) {
+        keys.push_back(*it);
+    }
+    return keys;
+}
 
-// [0]...contains...[b1]...add...[b2]...remove...[1]
-void experimentRoutine(ConcurrentSkipList<int>* list, int numOfOperations, double b1, double b2, double& time) {
-    std::mt19937 mt(rd());
-    std::uniform_real_distribution<double> dist(0.0, 1.0);
-    double decision;
-    clock_t start;
-    clock_t total = 0;
+vector<int> range(int first, int last, int step = 1) {
+    vector<int> keys;
+    for (int i = first; i < last; i += step) {
+        keys.push_back(i);
+    }
+    return keys;
+}
+
+// two threads add new minimums while two pop, every key comes out once
+void popAddRoutine(ConcurrentSkipList<int>* list, int first, int numOfOperations) {
     for (int i = 0; i < numOfOperations; ++i) {
-        decision = dist(mt);
-        if(decision < b1) {
-            start = clock();
-            list->contains(rd()%30000);
-            total += clock() - start;
-        } else {
-            if(decision < b2) {
-                start = clock();
-                list->add(rd()%30000);
-                total += clock() - start;
-            } else {
-                start = clock();
-                list->remove(rd()%30000);
-                total += clock() - start;
+        list->add(first - 2*i);
+    }
+}
+
+void popPopRoutine(ConcurrentSkipList<int>* list, int numOfOperations, vector<int>* popped) {
+    int value;
+    for (int i = 0; i < numOfOperations; ++i) {
+        if(list->popMin(value)) {
+            popped->push_back(value);
+        }
+    }
+}
+
+bool popTest() {
+    bool ok = true;
+    ConcurrentSkipList<int> list(20, 4, 0.5);
+    vector<int> keys = range(0, 100);
+    list.insertBatch(keys.begin(), keys.end());
+    int value;
+    for (int i = 0; i < 5; ++i) {
+        ok &= check(list.popMin(value) && value == i, "popMin() pops the smallest key");
+    }
+    // iterators step over the popped nodes that are still linked
+    ok &= check(keysOf(list) == range(5, 100), "iteration after popMin()");
+    ok &= check(!list.contains(3) && list.contains(5), "contains() after popMin()");
+    vector<int> popped;
+    while (list.popApproxMin(value)) {
+        popped.push_back(value);
+    }
+    sort(popped.begin(), popped.end());
+    ok &= check(popped == range(5, 100), "popApproxMin() pops every key once");
+    ok &= check(!list.popMin(value) && list.begin() == list.end(), "pops of an empty list");
+
+    vector<int> popped1, popped2;
+    std::thread t1(popAddRoutine, &list, 100000, 5000);
+    std::thread t2(popAddRoutine, &list, 99999, 5000);
+    std::thread t3(popPopRoutine, &list, 5000, &popped1);
+    std::thread t4(popPopRoutine, &list, 5000, &popped2);
+    t1.join();
+    t2.join();
+    t3.join();
+    t4.join();
+    popped1.insert(popped1.end(), popped2.begin(), popped2.end());
+    while (list.popMin(value)) {
+        popped1.push_back(value);
+    }
+    sort(popped1.begin(), popped1.end());
+    ok &= check(popped1 == range(100000 - 2*5000 + 1, 100001), "concurrent popMin() and adds of new minimums");
+    return ok;
+}
+
+bool mapTest() {
+    bool ok = true;
+    ConcurrentSkipListMap<int, long> map;
+    long value;
+    ok &= check(map.put(1, 10) && !map.put(1, 11), "put() of a new and a present key");
+    ok &= check(map.get(1, value) && value == 11, "get() after put()");
+    ok &= check(!map.putIfAbsent(1, 12, value) && value == 11, "putIfAbsent() of a present key");
+    ok &= check(map.putIfAbsent(2, 20) && map.get(2, value) && value == 20, "putIfAbsent() of a new key");
+    map.compute(2, [](const long* old) { return old == nullptr ? 0 : *old + 1; });
+    map.compute(3, [](const long* old) { return old == nullptr ? 30 : *old + 1; });
+    ok &= check(map.get(2, value) && value == 21 && map.get(3, value) && value == 30, "compute()");
+    ok &= check(map.remove(1) && !map.get(1, value) && !map.remove(1), "remove()");
+    long sum = 0;
+    map.rangeScan(0, 10, [&sum](int key, long mapped) { sum += key*mapped; });
+    ok &= check(sum == 2*21 + 3*30 && map.size() == 2, "rangeScan() and size()");
+    return ok;
+}
+
+bool iteratorTest() {
+    bool ok = true;
+    ConcurrentSkipList<int> list;
+    vector<int> keys = range(0, 100, 10);
+    list.insertBatch(keys.begin(), keys.end());
+    ok &= check(keysOf(list) == keys, "iteration in key order");
+    ok &= check(*list.lowerBound(20) == 20 && *list.lowerBound(21) == 30 && list.lowerBound(91) == list.end(), "lowerBound()");
+    ok &= check(*list.upperBound(20) == 30 && list.upperBound(90) == list.end(), "upperBound()");
+    int value;
+    ok &= check(list.ceiling(25, value) && value == 30 && !list.ceiling(91, value), "ceiling()");
+    ok &= check(list.floor(25, value) && value == 20 && list.floor(90, value) && value == 90 && !list.floor(-1, value), "floor()");
+    list.remove(30);
+    ok &= check(*list.lowerBound(21) == 40, "lowerBound() over a removed key");
+    int numOfCalls = list.rangeScan(15, 60, [&value](int key) { value = key; });
+    ok &= check(numOfCalls == 4 && value == 60, "rangeScan()");
+    return ok;
+}
+
+bool rankTest() {
+    bool ok = true;
+    ConcurrentSkipList<int> list(20, 8, 0.5);
+    vector<int> keys = range(0, 20000);
+    list.insertBatch(keys.begin(), keys.end());
+    // both are estimates, off by around 5% here
+    unsigned long long rank = list.rank(10000);
+    ok &= check(rank > 7500 && rank < 12500, "rank() within 25%");
+    ok &= check(list.rank(-1) == 0, "rank() below every key");
+    int value;
+    ok &= check(list.select(10000, value) && value > 7500 && value < 12500, "select() within 25%");
+    ok &= check(list.select(100000, value) && value == 19999, "select() past the end");
+    ConcurrentSkipList<int> empty;
+    ok &= check(!empty.select(0, value), "select() of an empty list");
+    return ok;
+}
+
+bool snapshotTest() {
+    bool ok = true;
+    const char* path = "check.snap";
+    ConcurrentSkipListMap<int, long> map;
+    for (int i = 0; i < 1000; ++i) {
+        map.put(i, i*2L);
+    }
+    ok &= check(map.saveSnapshot(path), "saveSnapshot()");
+    ConcurrentSkipListMap<int, long> loaded;
+    long value;
+    ok &= check(loaded.loadSnapshot(path) && loaded.size() == 1000 && loaded.get(999, value) && value == 1998, "loadSnapshot()");
+    ok &= check(!loaded.loadSnapshot(path), "loadSnapshot() into a list that isn't empty");
+    ConcurrentSkipListMap<long, long> otherKey;
+    ok &= check(!otherKey.loadSnapshot(path), "loadSnapshot() of another key type");
+
+    // the time left is saved, and counted from the load
+    ConcurrentSkipList<int, HazardDomain, void, std::less<int>, CheckClock> expiring;
+    expiring.add(1);
+    expiring.add(2, chrono::milliseconds(100));
+    expiring.add(3, chrono::milliseconds(10));
+    CheckClock::ticks += 50;
+    ok &= check(expiring.saveSnapshot(path), "saveSnapshot() of expiring keys");
+    CheckClock::ticks += 1000;
+    ConcurrentSkipList<int, HazardDomain, void, std::less<int>, CheckClock> restored;
+    ok &= check(restored.loadSnapshot(path) && keysOf(restored) == vector<int>({1, 2}), "expired keys aren't saved");
+    CheckClock::ticks += 40;
+    ok &= check(restored.contains(2), "a loaded key keeps the time it had left");
+    CheckClock::ticks += 20;
+    ok &= check(!restored.contains(2) && restored.contains(1), "a loaded key expires once its time is up");
+    remove(path);
+    return ok;
+}
+
+bool changeFeedTest() {
+    bool ok = true;
+    ConcurrentSkipList<int> list;
+    ChangeFeed<int>& feed = list.enableChangeFeed();
+    for (int i = 0; i < 10; ++i) {
+        list.add(i);
+    }
+    list.add(5);
+    list.remove(3);
+    list.remove(3);
+    int value;
+    list.popMin(value);
+    vector<ChangeFeed<int>::Change> changes;
+    ok &= check(feed.drain(changes) == 12, "one change per add, remove and pop that took effect");
+    bool isOrdered = true;
+    for (int i = 0; i < 12; ++i) {
+        isOrdered &= i == 0 || changes[i - 1].seq < changes[i].seq;
+    }
+    ok &= check(isOrdered, "changes in sequence order");
+    ok &= check(changes[3].op == ChangeFeed<int>::added && changes[3].key == 3
+                && changes[10].op == ChangeFeed<int>::removed && changes[10].key == 3
+                && changes[11].op == ChangeFeed<int>::removed && changes[11].key == 0, "changes in the order they took effect");
+    changes.clear();
+    ok &= check(feed.drain(changes) == 0 && feed.getNumOfDropped() == 0, "drain() of an empty feed");
+
+    // nobody drains this one, writers go on and the feed counts what it dropped
+    ConcurrentSkipList<int> undrained;
+    ChangeFeed<int>& full = undrained.enableChangeFeed(16);
+    for (int i = 0; i < 100; ++i) {
+        undrained.add(i);
+    }
+    ok &= check(full.drain(changes) == 16 && full.getNumOfDropped() == 84, "a full ring drops changes instead of waiting");
+    return ok;
+}
+
+bool expiryTest() {
+    bool ok = true;
+    ConcurrentSkipList<int, HazardDomain, void, std::less<int>, CheckClock> list;
+    for (int i = 0; i < 10; ++i) {
+        list.add(i, chrono::milliseconds(i < 5 ? 10 : 100));
+    }
+    list.add(10);
+    ok &= check(list.contains(0) && list.size() == 11, "keys before their deadline");
+    ok &= check(!list.add(0, chrono::milliseconds(1000)), "add() of a present expiring key");
+    CheckClock::ticks += 20;
+    ok &= check(!list.contains(0) && list.contains(5) && keysOf(list) == range(5, 11), "expired keys are absent");
+    ok &= check(list.add(0) && list.contains(0), "add() of an expired key");
+    ok &= check(list.expireAfter(5, chrono::milliseconds(500)), "expireAfter() of a present key");
+    CheckClock::ticks += 100;
+    ok &= check(list.expireSome(100) == 8, "expireSome() removes the expired keys");
+    ok &= check(!list.expireAfter(1, chrono::milliseconds(500)), "expireAfter() of an expired key");
+    ok &= check(keysOf(list) == vector<int>({0, 5, 10}), "keys after expireSome()");
+    int value;
+    CheckClock::ticks += 1000;
+    ok &= check(list.popMin(value) && value == 0 && list.popMin(value) && value == 10 && !list.popMin(value),
+                "popMin() skips expired keys");
+    return ok;
+}
+
+bool partitionedTest() {
+    bool ok = true;
+    PartitionedSkipList<int> batched(20, 8, 0.5, 4);
+    vector<int> keys = range(0, 1000);
+    ok &= check(batched.insertBatch(keys.begin(), keys.end()) == 1000 && batched.numOfRanges() == 4, "insertBatch() splits an empty list");
+    ok &= check(keysOf(batched) == keys && batched.size() == 1000, "iteration across shards");
+
+    PartitionedSkipList<int> list(20, 8, 0.5, 4);
+    for (int key : keys) {
+        list.add(key);
+    }
+    ok &= check(list.add(-5) && !list.add(500) && list.remove(-5) && !list.contains(-5), "add() and remove()");
+    ok &= check(list.split(250) && list.split(500) && !list.split(500) && list.numOfRanges() == 3, "split()");
+    ok &= check(list.shardIndexOf(249) != list.shardIndexOf(250) && list.shardIndexOf(250) == list.shardIndexOf(499), "ranges after split()");
+    ok &= check(list.moveBound(1, 300) && list.shardIndexOf(299) == list.shardIndexOf(0) && !list.moveBound(1, 600), "moveBound()");
+    vector<int> odds = range(1, 1000, 2);
+    ok &= check(list.removeBatch(odds.begin(), odds.end()) == 500, "removeBatch()");
+    list.rebalance();
+    ok &= check(list.numOfRanges() == 4 && keysOf(list) == range(0, 1000, 2) && list.size() == 500, "keys after rebalance()");
+    ok &= check(*list.lowerBound(123) == 124 && *list.upperBound(124) == 126, "lowerBound() and upperBound()");
+    int numOfCalls = list.rangeScan(100, 200, [](int) {});
+    ok &= check(numOfCalls == 51, "rangeScan() across shards");
+    return ok;
+}
+
+// Behavior of the list variants, runs before the experiments
+bool checks() {
+    bool ok = popTest();
+    ok &= mapTest();
+    ok &= iteratorTest();
+    ok &= rankTest();
+    ok &= snapshotTest();
+    ok &= changeFeedTest();
+    ok &= expiryTest();
+    ok &= partitionedTest();
+    cout << (ok ? "All checks passed" : "Some checks failed") << endl;
+    return ok;
+}
+
+// 1, 2, 4, ... threads up to maxNumOfThreads, which is always included
+vector<unsigned int> threadCounts(unsigned int maxNumOfThreads) {
+    vector<unsigned int> counts;
+    for (unsigned int k = 1; k < maxNumOfThreads; k *= 2) {
+        counts.push_back(k);
+    }
+    counts.push_back(maxNumOfThreads);
+    return counts;
+}
+
+// every mix and distribution for each P, maxHeight and thread count
+template <class List> void experiments(const char* name, int numOfOperations, const vector<unsigned int>& numsOfThreads,
+                                       const vector<double>& ps, const vector<unsigned int>& maxHeights,
+                                       ofstream& csv, ofstream& json, bool& isFirst) {
+    const double mixes[3][2] = {{0.9, 0.05},    // 90% contains, 5% add, 5% remove
+                                {0.8, 0.1},     // 80% contains, 10% add, 10% remove
+                                {0.34, 0.33}};  // 33% contains, 33% add, 33% remove
+    const KeyDistribution distributions[3] = {KeyDistribution::uniform, KeyDistribution::zipfian, KeyDistribution::sequential};
+
+    for (double p : ps) {
+        for (unsigned int maxHeight : maxHeights) {
+            for (const double* mix : mixes) {
+                for (KeyDistribution distribution : distributions) {
+                    for (unsigned int k : numsOfThreads) {
+                        BenchmarkConfig config;
+                        config.name = name;
+                        config.distribution = distribution;
+                        config.numOfThreads = k;
+                        config.numOfOperations = numOfOperations;
+                        config.containsRatio = mix[0];
+                        config.addRatio = mix[1];
+                        config.P = p;
+                        config.maxHeight = maxHeight;
+                        BenchmarkResult result = runBenchmark<List>(config);
+                        cout << name << "\tp " << p << "\tmaxHeight " << maxHeight << '\t' << toString(distribution) << '\t'
+                             << mix[0] << '/' << mix[1] << '\t' << k << " threads:\t"
+                             << result.opsPerSecond << " ops/s\tp50 " << result.p50 << " ns\tp99 " << result.p99
+                             << " ns\tp999 " << result.p999 << " ns" << endl;
+                        writeCsv(csv, result);
+                        writeJson(json, result, isFirst);
+                        isFirst = false;
+                    }
+                }
             }
         }
     }
-    time = ((double)total)/CLOCKS_PER_SEC;
-//    cout << time << endl;
 }
 
-double experiment(double p, unsigned int maxHeight, unsigned int numOfThreads, int numOfOperations, double b1, double b2) {
-    ConcurrentSkipList<int> list(maxHeight, numOfThreads, p);
-    randInit(&list);
-    double result = 0.0;
-    double* times = new double[numOfThreads];
+void levelRoutine(bool legacy, double p, unsigned int maxHeight, int numOfOperations, unsigned int& sum) {
+    LevelGenerator generator = legacy ? LevelGenerator::legacy(p, maxHeight-1) : LevelGenerator(p, maxHeight-1);
+    sum = 0;
+    for (int i = 0; i < numOfOperations; ++i) {
+        sum += generator.next();
+    }
+}
+
+// The list with the level draw it had before LevelGenerator, for the insert experiment
+class LegacyLevelSkipList : public ConcurrentSkipList<int> {
+public:
+    LegacyLevelSkipList(unsigned int maxHeight, unsigned int maxNumOfThreads, double P) : ConcurrentSkipList<int>(maxHeight, maxNumOfThreads, P) {
+        levelGenerator = LevelGenerator::legacy(P, this->maxHeight-1);
+    }
+};
+
+void insertRoutine(ConcurrentSkipList<int>* list, int first, int step, int numOfOperations) {
+    for (int i = 0; i < numOfOperations; ++i) {
+        list->add(first + i*step);
+    }
+}
+
+// draws per second over all threads
+double levelExperiment(bool legacy, unsigned int numOfThreads, int numOfOperations) {
+    unsigned int* sums = new unsigned int[numOfThreads];
     std::thread** threads = new std::thread*[numOfThreads];
+    auto start = chrono::steady_clock::now();
     for (int i = 0; i < numOfThreads; ++i) {
-        threads[i] = new std::thread(experimentRoutine, &list, numOfOperations, b1, b2, times[i]);
+        threads[i] = new std::thread(levelRoutine, legacy, 0.5, 20, numOfOperations, std::ref(sums[i]));
     }
     for (int i = 0; i < numOfThreads; ++i) {
         threads[i]->join();
+        delete threads[i];
     }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    delete[] threads;
+    delete[] sums;
+    return numOfOperations*numOfThreads/seconds;
+}
 
+// inserts per second over all threads, every thread adds its own disjoint keys
+template <class List> double insertExperiment(unsigned int numOfThreads, int numOfOperations) {
+    List list(20, numOfThreads, 0.5);
+    std::thread** threads = new std::thread*[numOfThreads];
+    auto start = chrono::steady_clock::now();
     for (int i = 0; i < numOfThreads; ++i) {
-//        cout << times[i] << endl;
-        result += times[i];
-    }
-    result /= numOfOperations*numOfThreads;
-//    list.print();
-    return result;
-}
-
-void experiments(double b1, double b2, int numOfOperations, ofstream& file) {
-    double p = 0.5;
-    double result;
-
-    for(int i = 0; i < 5; ++i) {
-        file << "p = " << p << endl;
-        for(unsigned int maxHeight = 5; maxHeight <= 40; maxHeight += 5) {
-            cout << "p = " << p << ", maxHeight = " << maxHeight << endl;
-            for (unsigned int k = 1; k <= 32; k *= 2) {
-                result = experiment(p, maxHeight, k, numOfOperations, b1, b2);
-                cout << '\t' << result << " s" <<  endl;
-                file << result << '\t';
-            }
-            cout << endl;
-            file << endl;
+        threads[i] = new std::thread(insertRoutine, &list, i, (int)numOfThreads, numOfOperations);
+    }
+    for (int i = 0; i < numOfThreads; ++i) {
+        threads[i]->join();
+        delete threads[i];
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    delete[] threads;
+    return numOfOperations*numOfThreads/seconds;
+}
+
+void insertExperiments(int numOfOperations, ofstream& file) {
+    double legacyDraws, draws, legacyInserts, inserts;
+    file << "threads\tlegacy levels/s\tlevels/s\tlegacy inserts/s\tinserts/s" << endl;
+    for (unsigned int k = 1; k <= 32; k *= 2) {
+        legacyDraws = levelExperiment(true, k, numOfOperations);
+        draws = levelExperiment(false, k, numOfOperations);
+        legacyInserts = insertExperiment<LegacyLevelSkipList>(k, numOfOperations);
+        inserts = insertExperiment<ConcurrentSkipList<int>>(k, numOfOperations);
+        cout << k << " threads:\t" << legacyDraws << "\t" << draws << "\t" << legacyInserts << "\t" << inserts << endl;
+        file << k << '\t' << legacyDraws << '\t' << draws << '\t' << legacyInserts << '\t' << inserts << endl;
+    }
+}
+
+// Pop as it was done before popMin(): remove the first key that is still there
+bool removeFirstPop(ConcurrentSkipList<int>* list, int& result) {
+    for (ConcurrentSkipList<int>::Iterator it = list->begin(); it != list->end(); ++it) {
+        if(list->remove(*it)) {
+            result = *it;
+            return true;
         }
-        p = p + 0.1;
-        file << endl;
     }
+    return false;
 }
 
+// mode 0 removes the first key, 1 is popMin(), 2 is popApproxMin()
+void popRoutine(ConcurrentSkipList<int>* list, int mode, int numOfOperations) {
+    int value;
+    for (int i = 0; i < numOfOperations; ++i) {
+        if(mode == 0) {
+            removeFirstPop(list, value);
+        } else if(mode == 1) {
+            list->popMin(value);
+        } else {
+            list->popApproxMin(value);
+        }
+    }
+}
 
+// pops per second over all threads, the list starts with as many keys as they pop
+double popExperiment(int mode, unsigned int numOfThreads, int numOfOperations) {
+    ConcurrentSkipList<int> list(20, numOfThreads, 0.5);
+    vector<int> keys(numOfOperations*numOfThreads);
+    for (int i = 0; i < keys.size(); ++i) {
+        keys[i] = i;
+    }
+    list.insertBatch(keys.begin(), keys.end());
+    std::thread** threads = new std::thread*[numOfThreads];
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < numOfThreads; ++i) {
+        threads[i] = new std::thread(popRoutine, &list, mode, numOfOperations);
+    }
+    for (int i = 0; i < numOfThreads; ++i) {
+        threads[i]->join();
+        delete threads[i];
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    delete[] threads;
+    return numOfOperations*numOfThreads/seconds;
+}
 
-int main() {
-//    bool mark = false;
-//    AtomicMarkableReference<int> ref(new int(5), true);
-//    int* ref5 = ref.getRefAndMark(mark);
-//    cout << ref5 << " " << mark << endl;
+void popExperiments(int numOfOperations, ofstream& file) {
+    double removes, pops, approxPops;
+    file << "threads\tremove first/s\tpopMin/s\tpopApproxMin/s" << endl;
+    for (unsigned int k = 1; k <= 32; k *= 2) {
+        removes = popExperiment(0, k, numOfOperations);
+        pops = popExperiment(1, k, numOfOperations);
+        approxPops = popExperiment(2, k, numOfOperations);
+        cout << k << " threads:\t" << removes << "\t" << pops << "\t" << approxPops << endl;
+        file << k << '\t' << removes << '\t' << pops << '\t' << approxPops << endl;
+    }
+}
 
+// ConcurrentSkipList [operations per thread] [csv path] [json path] [max threads]
+int main(int argc, char** argv) {
 //    repeatTest(1);
 //    repeatTest(3577);
-
-    int numOfOperations = 5000;
-    ofstream file("results.txt");
-    if(!file.is_open()) {
-        cout << "Cannot create/open file result.txt" << endl;
+    if(!checks()) {
         return -1;
     }
 
-    cout.setf(ios::fixed);
-    file.setf(ios::fixed);
-    cout.precision(9);
-    file.precision(9);
-
-    cout << "Time in seconds" << endl << endl;
-    file << "Time in seconds" << endl << endl;
-
-    cout << "90%/5%/5%" << endl;
-    file << "90%/5%/5%" << endl;
-    experiments(0.9, 0.95, numOfOperations, file);  // 90% - contains
-                                                    // 5% - add
-                                                    // 5% - remove
-
-    cout << endl <<  "80%/10%/10%" << endl;
-    file << endl <<  "80%/10%/10%" << endl;
-    experiments(0.8, 0.9, numOfOperations, file);   // 80% - contains
-                                                    // 10% - add
-                                                    // 10% - remove
-
-    cout << endl <<  "33%/33%/33%" << endl;
-    file << endl <<  "33%/33%/33%" << endl;
-    experiments(0.34, 0.67, numOfOperations, file); // 33% - contains
-                                                    // 33% - add
-                                                    // 33% - remove
+    int numOfOperations = argc > 1 ? atoi(argv[1]) : 100000;
+    const char* csvPath = argc > 2 ? argv[2] : "results.csv";
+    const char* jsonPath = argc > 3 ? argv[3] : "results.json";
+    unsigned int maxNumOfThreads = argc > 4 ? atoi(argv[4]) : thread::hardware_concurrency();
+    vector<unsigned int> numsOfThreads = threadCounts(maxNumOfThreads > 0 ? maxNumOfThreads : 1);
+    ofstream csv(csvPath);
+    ofstream json(jsonPath);
+    if(!csv.is_open() || !json.is_open()) {
+        cout << "Cannot create/open " << csvPath << " or " << jsonPath << endl;
+        return -1;
+    }
 
-    file.close();
+    // the reclamation policies are compared over the whole p/maxHeight grid, the rest at the defaults
+    vector<double> ps = {0.5, 0.6, 0.7, 0.8, 0.9};
+    vector<unsigned int> maxHeights = {5, 10, 15, 20, 25, 30, 35, 40};
+    vector<double> defaultPs = {BenchmarkConfig().P};
+    vector<unsigned int> defaultMaxHeights = {BenchmarkConfig().maxHeight};
+
+    bool isFirst = true;
+    writeCsvHeader(csv);
+    json << "[" << endl;
+    experiments<ConcurrentSkipList<int, HazardDomain>>("lockfree-hp", numOfOperations, numsOfThreads, ps, maxHeights, csv, json, isFirst);
+    experiments<ConcurrentSkipList<int, EpochDomain>>("lockfree-ebr", numOfOperations, numsOfThreads, ps, maxHeights, csv, json, isFirst);
+    experiments<PartitionedSkipList<int, HazardDomain>>("partitioned-hp", numOfOperations, numsOfThreads, defaultPs, defaultMaxHeights,
+                                                        csv, json, isFirst);
+    experiments<ConcurrentUnrolledSkipList<int>>("unrolled-hp", numOfOperations, numsOfThreads, defaultPs, defaultMaxHeights,
+                                                 csv, json, isFirst);
+    experiments<LazySkipList<int>>("lazy", numOfOperations, numsOfThreads, defaultPs, defaultMaxHeights, csv, json, isFirst);
+    experiments<LockedSet<int, mutex>>("set-mutex", numOfOperations, numsOfThreads, defaultPs, defaultMaxHeights, csv, json, isFirst);
+    experiments<LockedSet<int, shared_mutex>>("set-shared-mutex", numOfOperations, numsOfThreads, defaultPs, defaultMaxHeights,
+                                              csv, json, isFirst);
+    json << endl << "]" << endl;
+
+    ofstream file("levels.txt");
+    cout << endl << "Level draws and inserts per second (legacy mt19937 per insert vs LevelGenerator)" << endl;
+    insertExperiments(numOfOperations, file);
+
+    ofstream popFile("pops.txt");
+    cout << endl << "Pops per second (remove of the first key vs popMin vs popApproxMin)" << endl;
+    popExperiments(numOfOperations, popFile);
     return 0;
 }
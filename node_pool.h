@@ -0,0 +1,137 @@
+#ifndef NODE_POOL_H
+#define NODE_POOL_H
+
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <vector>
+#include "cell_array.h"
+
+// Fixed-size block allocator for skip-list nodes, one size class per tower level.
+// Every thread keeps its own free lists, so the hot path is a pointer pop/push without
+// atomics. Blocks are carved from chunks in batches, overflow of a thread cache and the
+// caches of exiting threads go to a shared per-class list. Chunks are returned to the
+// system only at process exit, the pool keeps the peak footprint like any arena.
+// Chunks are line aligned and block sizes are powers of two up to a cache line and whole
+// lines above it, so a node never straddles more lines than its size needs.
+template <class N> class NodePool {
+public:
+    static const unsigned int maxNumOfClasses = 64;
+
+private:
+    static const unsigned int blockAlignment = 16;
+    static const unsigned int blocksPerChunk = 64;
+    static const unsigned int maxCachedBlocks = 256;
+    static const unsigned int transferBatch = 128;
+
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    struct FreeList {
+        FreeBlock* head = nullptr;
+        unsigned int count = 0;
+
+        void push(FreeBlock* block) {
+            block->next = head;
+            head = block;
+            ++count;
+        }
+
+        FreeBlock* pop() {
+            FreeBlock* block = head;
+            head = block->next;
+            --count;
+            return block;
+        }
+    };
+
+    struct SharedPool {
+        std::mutex mutex;
+        FreeList lists[maxNumOfClasses];
+        std::vector<void*> chunks;
+
+        ~SharedPool() {
+            for (void* chunk : chunks) {
+                ::operator delete(chunk, std::align_val_t(cacheLineSize));
+            }
+        }
+    };
+
+    struct ThreadCache {
+        FreeList lists[maxNumOfClasses];
+
+        ~ThreadCache() {
+            SharedPool& pool = sharedPool();
+            std::lock_guard<std::mutex> lock(pool.mutex);
+            for (unsigned int i = 0; i < maxNumOfClasses; ++i) {
+                while (lists[i].count > 0) {
+                    pool.lists[i].push(lists[i].pop());
+                }
+            }
+        }
+    };
+
+public:
+    static void* allocate(unsigned int sizeClass, std::size_t size) {
+        FreeList& list = threadCache().lists[sizeClass];
+        if(list.count == 0) {
+            refill(list, sizeClass, size);
+        }
+        return list.pop();
+    }
+
+    static void deallocate(void* ptr, unsigned int sizeClass) {
+        FreeList& list = threadCache().lists[sizeClass];
+        list.push(static_cast<FreeBlock*>(ptr));
+        if(list.count > maxCachedBlocks) {
+            SharedPool& pool = sharedPool();
+            std::lock_guard<std::mutex> lock(pool.mutex);
+            for (unsigned int i = 0; i < transferBatch; ++i) {
+                pool.lists[sizeClass].push(list.pop());
+            }
+        }
+    }
+
+private:
+    static SharedPool& sharedPool() {
+        static SharedPool pool;
+        return pool;
+    }
+
+    static ThreadCache& threadCache() {
+        static thread_local ThreadCache cache;
+        return cache;
+    }
+
+    static std::size_t blockSizeOf(std::size_t size) {
+        if(size > cacheLineSize) {
+            return (size + cacheLineSize - 1) / cacheLineSize * cacheLineSize;
+        }
+        std::size_t blockSize = blockAlignment;
+        while (blockSize < size) {
+            blockSize *= 2;
+        }
+        return blockSize;
+    }
+
+    static void refill(FreeList& list, unsigned int sizeClass, std::size_t size) {
+        SharedPool& pool = sharedPool();
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        FreeList& shared = pool.lists[sizeClass];
+        while (shared.count > 0 && list.count < transferBatch) {
+            list.push(shared.pop());
+        }
+        if(list.count > 0) {
+            return;
+        }
+        std::size_t blockSize = blockSizeOf(size);
+        char* chunk = static_cast<char*>(::operator new(blockSize * blocksPerChunk, std::align_val_t(cacheLineSize)));
+        pool.chunks.push_back(chunk);
+        for (unsigned int i = blocksPerChunk; i > 0; --i) {
+            list.push(reinterpret_cast<FreeBlock*>(chunk + (i-1)*blockSize));
+        }
+    }
+};
+
+#endif //NODE_POOL_H
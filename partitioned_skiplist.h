@@ -0,0 +1,545 @@
+#ifndef PARTITIONED_SKIPLIST_H
+#define PARTITIONED_SKIPLIST_H
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+#include "concurrent_lockfree_skiplist.h"
+#include "epoch_domain.h"
+
+// Set that splits the key space into consecutive ranges, each held by its own
+// ConcurrentSkipList shard with its own towers, reclamation domain and counters, so threads
+// working on different ranges don't share a head tower or hazard cells. The routing table
+// that maps ranges to shards is immutable and replaced as a whole; operations announce
+// themselves in an EpochDomain while they use it, so a rebalance can wait until the old
+// table is out of use. Rebalancing moves the keys of one range to another shard online,
+// only adds and removes of keys in that range wait for it.
+//
+// NUMA: nodes come from the per-thread NodePool caches and are placed on first touch, on
+// the node of the thread that adds them. With placeShard every shard is also built on a
+// thread of its own that first calls placeShard(shard index), which may pin itself (e.g.
+// sched_setaffinity or numa_run_on_node), so the shard's head, tail, cells and counters
+// are touched first there. Threads pinned to a node should then mostly update the ranges
+// of its shards, see shardIndexOf().
+template <class T, template <class, class> class Reclaimer = HazardDomain, class Compare = std::less<T>>
+class PartitionedSkipList {
+    typedef ConcurrentSkipList<T, Reclaimer, void, Compare> Shard;
+
+    // Entry 0 holds the keys below bounds[0], entry i the keys in [bounds[i-1], bounds[i]),
+    // the last one everything from its bound up
+    struct Routing {
+        std::vector<T> bounds;
+        std::vector<unsigned int> shards;
+        // the range being moved, [frozenLo, frozenHi) or up from frozenLo without frozenHi
+        std::optional<T> frozenLo;
+        std::optional<T> frozenHi;
+        unsigned long long version = 0;
+    };
+
+public:
+    static const unsigned int defaultNumOfShards = 8;
+
+    // Weakly consistent like ConcurrentSkipList::Iterator, in key order across the shards.
+    // A step that finds the routing table replaced seeks past the current key in the new one.
+    class Iterator {
+        friend class PartitionedSkipList;
+
+        PartitionedSkipList* list;
+        // the routing table the position was found in
+        unsigned long long version;
+        unsigned int entry;
+        // empty at the end
+        std::optional<typename Shard::Iterator> it;
+
+        explicit Iterator(PartitionedSkipList* list) {
+            this->list = list;
+            version = 0;
+            entry = 0;
+        }
+
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef T value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const T* pointer;
+        typedef const T& reference;
+
+        reference operator*() const {
+            return **it;
+        }
+
+        pointer operator->() const {
+            return &**it;
+        }
+
+        Iterator& operator++() {
+            int cellIndex = list->routingDomain->acquireCell();
+            Routing* routing = list->routing.load(std::memory_order_acquire);
+            if(routing->version == version) {
+                ++*it;
+                list->settle(*this, *routing);
+            } else {
+                list->seekIn(*this, *routing, **it, true);
+            }
+            list->routingDomain->releaseCell(cellIndex);
+            return *this;
+        }
+
+        Iterator operator++(int) {
+            Iterator result(*this);
+            ++(*this);
+            return result;
+        }
+
+        bool operator==(const Iterator& other) const {
+            return it.has_value() == other.it.has_value() && (!it.has_value() || *it == *other.it);
+        }
+
+        bool operator!=(const Iterator& other) const {
+            return !(*this == other);
+        }
+    };
+
+    // attach() of the routing domain and every shard, see ConcurrentSkipList::attach(). A
+    // thread can bind only so many domains, with more shards than that the rest keep
+    // claiming cells per operation.
+    class ThreadHandle {
+        friend class PartitionedSkipList;
+
+        PartitionedSkipList* list;
+        std::vector<typename Shard::ThreadHandle> shardHandles;
+
+        explicit ThreadHandle(PartitionedSkipList* list) {
+            this->list = list;
+        }
+
+    public:
+        ThreadHandle(ThreadHandle&& other) noexcept : shardHandles(std::move(other.shardHandles)) {
+            list = other.list;
+            other.list = nullptr;
+        }
+
+        ThreadHandle(const ThreadHandle&) = delete;
+        ThreadHandle& operator=(const ThreadHandle&) = delete;
+
+        ~ThreadHandle() {
+            if(list != nullptr) {
+                list->routingDomain->detachThread();
+            }
+        }
+    };
+
+// FIELDS
+private:
+    Compare comparator;
+
+    std::vector<Shard*> shards;
+
+    std::atomic<Routing*> routing;
+    // only announcements and synchronize(), a replaced table is deleted right after that
+    EpochDomain<Routing>* routingDomain;
+
+    // one rebalance at a time
+    std::mutex rebalanceMutex;
+
+// CONSTRUCTORS
+public:
+    // Starts with one range on shard 0, the others are taken by split(), rebalance() or the
+    // first insertBatch(). The shards get maxHeight, maxNumOfThreads and P.
+    explicit PartitionedSkipList(unsigned int maxHeight = Shard::defaultMaxHeight, unsigned int maxNumOfThreads = 8, double P = 0.7,
+                                 unsigned int numOfShards = defaultNumOfShards, const Compare& comparator = Compare(),
+                                 const std::function<void(unsigned int)>& placeShard = nullptr) : comparator(comparator) {
+        shards.resize(numOfShards > 0 ? numOfShards : 1);
+        for (unsigned int i = 0; i < shards.size(); ++i) {
+            if(placeShard) {
+                std::thread builder([&, i] {
+                    placeShard(i);
+                    shards[i] = new Shard(maxHeight, maxNumOfThreads, P, comparator);
+                });
+                builder.join();
+            } else {
+                shards[i] = new Shard(maxHeight, maxNumOfThreads, P, comparator);
+            }
+        }
+        routingDomain = new EpochDomain<Routing>(0, maxNumOfThreads);
+        Routing* initial = new Routing();
+        initial->shards.push_back(0);
+        routing.store(initial, std::memory_order_release);
+    }
+
+//DESTRUCTOR
+    ~PartitionedSkipList() {
+        for (Shard* shard : shards) {
+            delete shard;
+        }
+        delete routing.load(std::memory_order_relaxed);
+        delete routingDomain;
+    }
+
+// PUBLIC METHODS
+public:
+    bool contains(const T& value) {
+        int cellIndex = routingDomain->acquireCell();
+        Routing* current = routing.load(std::memory_order_acquire);
+        bool result = shardOf(*current, value)->contains(value);
+        routingDomain->releaseCell(cellIndex);
+        return result;
+    }
+
+    bool add(const T& value) {
+        return update(value, [&value](Shard* shard) { return shard->add(value); });
+    }
+
+    bool remove(const T& value) {
+        return update(value, [&value](Shard* shard) { return shard->remove(value); });
+    }
+
+    // ConcurrentSkipList::insertBatch() per range. The first batch into an empty list with
+    // unused shards splits it first, at the batch's quantiles.
+    template <class It> int insertBatch(It begin, It end) {
+        std::vector<T> values = sortedBatch(begin, end);
+        if(!values.empty() && size() == 0) {
+            std::lock_guard<std::mutex> lock(rebalanceMutex);
+            for (unsigned int i = 1; i < shards.size(); ++i) {
+                splitAt(values[values.size() * i / shards.size()]);
+            }
+        }
+        return applyBatch(values, [](Shard* shard, typename std::vector<T>::iterator first, typename std::vector<T>::iterator last) {
+            return shard->insertBatch(first, last);
+        });
+    }
+
+    template <class It> int removeBatch(It begin, It end) {
+        std::vector<T> values = sortedBatch(begin, end);
+        return applyBatch(values, [](Shard* shard, typename std::vector<T>::iterator first, typename std::vector<T>::iterator last) {
+            return shard->removeBatch(first, last);
+        });
+    }
+
+    // Sum of the shards' size(); keys being moved count twice for a while
+    unsigned long long size() {
+        unsigned long long sum = 0;
+        for (Shard* shard : shards) {
+            sum += shard->size();
+        }
+        return sum;
+    }
+
+    ThreadHandle attach(bool withFinger = false) {
+        routingDomain->attachThread();
+        ThreadHandle handle(this);
+        handle.shardHandles.reserve(shards.size());
+        for (Shard* shard : shards) {
+            handle.shardHandles.push_back(shard->attach(withFinger));
+        }
+        return handle;
+    }
+
+    Iterator begin() {
+        return makeIterator(nullptr, false);
+    }
+
+    Iterator end() {
+        return Iterator(this);
+    }
+
+    // First key >= value
+    Iterator lowerBound(const T& value) {
+        return makeIterator(&value, false);
+    }
+
+    // First key > value
+    Iterator upperBound(const T& value) {
+        return makeIterator(&value, true);
+    }
+
+    // Calls callback(key) for every key in [lo, hi] in ascending order, returns the number of calls
+    template <class F> int rangeScan(const T& lo, const T& hi, F callback) {
+        int count = 0;
+        for (Iterator it = lowerBound(lo); it != end() && !isLess(hi, *it); ++it) {
+            callback(*it);
+            ++count;
+        }
+        return count;
+    }
+
+    unsigned int numOfShards() const {
+        return shards.size();
+    }
+
+    unsigned int numOfRanges() {
+        int cellIndex = routingDomain->acquireCell();
+        unsigned int result = routing.load(std::memory_order_acquire)->shards.size();
+        routingDomain->releaseCell(cellIndex);
+        return result;
+    }
+
+    // Shard holding value right now, for placing the threads that work on it
+    unsigned int shardIndexOf(const T& value) {
+        int cellIndex = routingDomain->acquireCell();
+        Routing* current = routing.load(std::memory_order_acquire);
+        unsigned int result = current->shards[entryOf(*current, value)];
+        routingDomain->releaseCell(cellIndex);
+        return result;
+    }
+
+    // Gives the keys from value up to the end of its range to an unused shard. Returns false if
+    // value already starts a range or every shard is in use.
+    bool split(const T& value) {
+        std::lock_guard<std::mutex> lock(rebalanceMutex);
+        return splitAt(value);
+    }
+
+    // Moves the lower bound of range i (counting from 0) to value, which must lie strictly
+    // between the bounds of ranges i-1 and i+1, and the keys in between to the shard that
+    // now covers them. Returns false if i or value is out of bounds.
+    bool moveBound(unsigned int i, const T& value) {
+        std::lock_guard<std::mutex> lock(rebalanceMutex);
+        return moveBoundAt(i, value);
+    }
+
+    // Splits the biggest range at its middle key while there are unused shards, then moves
+    // each bound, left to right, to the middle of its two ranges where one holds more than
+    // 5/8 of their keys. Sizes and middles come from size() and select(), so the result is
+    // roughly even. Returns the number of bounds set.
+    unsigned int rebalance() {
+        std::lock_guard<std::mutex> lock(rebalanceMutex);
+        unsigned int numOfMoves = 0;
+        while (routing.load(std::memory_order_relaxed)->shards.size() < shards.size()) {
+            Routing* current = routing.load(std::memory_order_relaxed);
+            Shard* biggest = shards[current->shards[0]];
+            for (unsigned int shardIndex : current->shards) {
+                if(shards[shardIndex]->size() > biggest->size()) {
+                    biggest = shards[shardIndex];
+                }
+            }
+            T middle;
+            if(biggest->size() < 2 || !biggest->select(biggest->size() / 2, middle) || !splitAt(middle)) {
+                break;
+            }
+            ++numOfMoves;
+        }
+        for (unsigned int i = 1; i < routing.load(std::memory_order_relaxed)->shards.size(); ++i) {
+            Routing* current = routing.load(std::memory_order_relaxed);
+            Shard* left = shards[current->shards[i - 1]];
+            Shard* right = shards[current->shards[i]];
+            unsigned long long numOfLeft = left->size();
+            unsigned long long numOfRight = right->size();
+            unsigned long long half = (numOfLeft + numOfRight) / 2;
+            unsigned long long difference = numOfLeft > numOfRight ? numOfLeft - numOfRight : numOfRight - numOfLeft;
+            if(4 * difference <= numOfLeft + numOfRight) {
+                continue;
+            }
+            T bound;
+            bool found = numOfLeft > numOfRight ? left->select(half, bound) : right->select(numOfRight - half, bound);
+            if(found && moveBoundAt(i, bound)) {
+                ++numOfMoves;
+            }
+        }
+        return numOfMoves;
+    }
+
+// PRIVATE METHODS
+private:
+    // Runs apply(shard) for the shard of value, waiting while value is being moved
+    template <class F> bool update(const T& value, F apply) {
+        while (true) {
+            int cellIndex = routingDomain->acquireCell();
+            Routing* current = routing.load(std::memory_order_acquire);
+            if(!isFrozen(*current, value)) {
+                bool result = apply(shardOf(*current, value));
+                routingDomain->releaseCell(cellIndex);
+                return result;
+            }
+            routingDomain->releaseCell(cellIndex);
+            std::this_thread::yield();
+        }
+    }
+
+    // Runs apply(shard, first, last) for every run of the sorted values that falls in one
+    // range, a run that overlaps a range being moved waits
+    template <class F> int applyBatch(std::vector<T>& values, F apply) {
+        int count = 0;
+        std::size_t first = 0;
+        while (first < values.size()) {
+            int cellIndex = routingDomain->acquireCell();
+            Routing* current = routing.load(std::memory_order_acquire);
+            unsigned int entry = entryOf(*current, values[first]);
+            std::size_t last = values.size();
+            if(entry + 1 < current->shards.size()) {
+                last = std::lower_bound(values.begin() + first, values.end(), current->bounds[entry],
+                                        [this](const T& a, const T& b) { return isLess(a, b); }) - values.begin();
+            }
+            bool isBlocked = false;
+            if(current->frozenLo) {
+                std::size_t frozen = std::lower_bound(values.begin() + first, values.begin() + last, *current->frozenLo,
+                                                      [this](const T& a, const T& b) { return isLess(a, b); }) - values.begin();
+                isBlocked = frozen < last && isFrozen(*current, values[frozen]);
+            }
+            if(!isBlocked) {
+                count += apply(shards[current->shards[entry]], values.begin() + first, values.begin() + last);
+                first = last;
+            }
+            routingDomain->releaseCell(cellIndex);
+            if(isBlocked) {
+                std::this_thread::yield();
+            }
+        }
+        return count;
+    }
+
+    // Index of the range holding value
+    unsigned int entryOf(const Routing& current, const T& value) {
+        return std::upper_bound(current.bounds.begin(), current.bounds.end(), value,
+                                [this](const T& a, const T& b) { return isLess(a, b); }) - current.bounds.begin();
+    }
+
+    Shard* shardOf(const Routing& current, const T& value) {
+        return shards[current.shards[entryOf(current, value)]];
+    }
+
+    bool isFrozen(const Routing& current, const T& value) {
+        return current.frozenLo && !isLess(value, *current.frozenLo) && (!current.frozenHi || isLess(value, *current.frozenHi));
+    }
+
+    bool splitAt(const T& value) {
+        Routing* current = routing.load(std::memory_order_relaxed);
+        unsigned int entry = entryOf(*current, value);
+        if(entry > 0 && !isLess(current->bounds[entry - 1], value)) {
+            return false;
+        }
+        unsigned int spare = 0;
+        while (spare < shards.size() && std::find(current->shards.begin(), current->shards.end(), spare) != current->shards.end()) {
+            ++spare;
+        }
+        if(spare == shards.size()) {
+            return false;
+        }
+        std::optional<T> hi;
+        if(entry < current->bounds.size()) {
+            hi = current->bounds[entry];
+        }
+        Routing* next = new Routing(*current);
+        next->bounds.insert(next->bounds.begin() + entry, value);
+        next->shards.insert(next->shards.begin() + entry + 1, spare);
+        moveRange(value, hi, current->shards[entry], spare, next);
+        return true;
+    }
+
+    bool moveBoundAt(unsigned int i, const T& value) {
+        Routing* current = routing.load(std::memory_order_relaxed);
+        if(i == 0 || i >= current->shards.size()
+           || (i >= 2 && !isLess(current->bounds[i - 2], value))
+           || (i < current->bounds.size() && !isLess(value, current->bounds[i]))) {
+            return false;
+        }
+        T bound = current->bounds[i - 1];
+        if(!isLess(value, bound) && !isLess(bound, value)) {
+            return true;
+        }
+        Routing* next = new Routing(*current);
+        next->bounds[i - 1] = value;
+        if(isLess(value, bound)) {
+            moveRange(value, bound, current->shards[i - 1], current->shards[i], next);
+        } else {
+            moveRange(bound, value, current->shards[i], current->shards[i - 1], next);
+        }
+        return true;
+    }
+
+    // Copies the keys of [lo, hi) from shard `from` to shard `to` while updates of the range
+    // wait on a frozen table, switches to next and then removes them from `from`: readers of
+    // the frozen table find every key in `from`, readers of next in `to`.
+    void moveRange(const T& lo, const std::optional<T>& hi, unsigned int from, unsigned int to, Routing* next) {
+        Routing* frozen = new Routing(*routing.load(std::memory_order_relaxed));
+        frozen->frozenLo = lo;
+        frozen->frozenHi = hi;
+        ++frozen->version;
+        publish(frozen);
+        std::vector<T> keys;
+        for (auto it = shards[from]->lowerBound(lo); it != shards[from]->end() && (!hi || isLess(*it, *hi)); ++it) {
+            keys.push_back(*it);
+        }
+        shards[to]->insertBatch(keys.begin(), keys.end());
+        next->frozenLo.reset();
+        next->frozenHi.reset();
+        next->version = frozen->version + 1;
+        publish(next);
+        shards[from]->removeBatch(keys.begin(), keys.end());
+    }
+
+    // Replaces the table and deletes the old one once no operation can still be using it
+    void publish(Routing* next) {
+        Routing* old = routing.load(std::memory_order_relaxed);
+        routing.store(next, std::memory_order_seq_cst);
+        routingDomain->synchronize();
+        delete old;
+    }
+
+    Iterator makeIterator(const T* value, bool strict) {
+        Iterator result(this);
+        int cellIndex = routingDomain->acquireCell();
+        Routing* current = routing.load(std::memory_order_acquire);
+        if(value == nullptr) {
+            result.version = current->version;
+            result.it = shards[current->shards[0]]->begin();
+            settle(result, *current);
+        } else {
+            seekIn(result, *current, *value, strict);
+        }
+        routingDomain->releaseCell(cellIndex);
+        return result;
+    }
+
+    // Positions iterator at the first key >= value (> if strict) of the table
+    void seekIn(Iterator& iterator, const Routing& current, const T& value, bool strict) {
+        unsigned int entry = entryOf(current, value);
+        Shard* shard = shards[current.shards[entry]];
+        // value may live in the node the iterator holds, look it up before letting go
+        iterator.it = strict ? shard->upperBound(value) : shard->lowerBound(value);
+        iterator.entry = entry;
+        iterator.version = current.version;
+        settle(iterator, current);
+    }
+
+    // Moves an iterator that ran past its range on to the next non-empty one; keys a shard
+    // holds outside its range while they are being moved are skipped
+    void settle(Iterator& iterator, const Routing& current) {
+        while (true) {
+            Shard* shard = shards[current.shards[iterator.entry]];
+            if(*iterator.it != shard->end()
+               && (iterator.entry + 1 == current.shards.size() || isLess(**iterator.it, current.bounds[iterator.entry]))) {
+                return;
+            }
+            if(++iterator.entry == current.shards.size()) {
+                iterator.it.reset();
+                return;
+            }
+            iterator.it = shards[current.shards[iterator.entry]]->lowerBound(current.bounds[iterator.entry - 1]);
+        }
+    }
+
+    template <class It> std::vector<T> sortedBatch(It begin, It end) {
+        std::vector<T> values(begin, end);
+        std::sort(values.begin(), values.end(), [this](const T& a, const T& b) { return isLess(a, b); });
+        return values;
+    }
+
+    bool isLess(const T& a, const T& b) {
+        return isNegative(comparator(a, b));
+    }
+
+    static bool isNegative(bool isLess) {
+        return isLess;
+    }
+
+    template <class R> static bool isNegative(R order) {
+        return order < 0;
+    }
+};
+
+#endif //PARTITIONED_SKIPLIST_H
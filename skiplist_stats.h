@@ -0,0 +1,132 @@
+#ifndef SKIPLIST_STATS_H
+#define SKIPLIST_STATS_H
+
+// Contention and reclamation counters, compiled in only with -DSKIPLIST_STATS.
+// SKIPLIST_STAT(statement) expands to nothing otherwise, so the counters cost nothing when off.
+#ifdef SKIPLIST_STATS
+#define SKIPLIST_STAT(statement) statement
+#else
+#define SKIPLIST_STAT(statement)
+#endif
+
+#ifdef SKIPLIST_STATS
+
+#include <atomic>
+#include <chrono>
+#include <ostream>
+
+// Counter written only by the thread holding the cell it belongs to, so a relaxed
+// load and store are enough; readers may see a slightly stale value.
+class StatCounter {
+    std::atomic<unsigned long long> value{0};
+
+public:
+    void add(unsigned long long n = 1) {
+        value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    void max(unsigned long long n) {
+        if(n > value.load(std::memory_order_relaxed)) {
+            value.store(n, std::memory_order_relaxed);
+        }
+    }
+
+    unsigned long long get() const {
+        return value.load(std::memory_order_relaxed);
+    }
+};
+
+inline unsigned long long statsNow() {
+    return (unsigned long long)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Totals over all cells at the time of the stats() call
+struct SkipListStats {
+    static const unsigned int maxNumOfLevels = 64;
+
+    unsigned long long numOfSearches = 0;
+    unsigned long long numOfTraversedNodes = 0;    // hops over all searches
+    unsigned long long numOfFindRestarts = 0;      // searches restarted from head
+    unsigned long long numOfLinkRetries = 0;       // re-finds while linking an upper level in add
+    unsigned long long numOfMarkRetries = 0;       // failed CAS while remove marks a tower
+    unsigned long long casFailures[maxNumOfLevels] = {};
+
+    unsigned long long numOfScans = 0;             // hazard scans, or limbo bags freed by EBR
+    unsigned long long numOfScannedRefs = 0;       // retired pointers examined by those
+    unsigned long long numOfScannedHazards = 0;    // hazard pointers collected by scans
+    unsigned long long numOfReclaimed = 0;
+    unsigned long long reclamationNs = 0;          // retire to free, summed over reclaimed nodes
+    unsigned long long maxReclamationNs = 0;
+
+    void print(std::ostream& out) const {
+        out << "searches " << numOfSearches
+            << ", nodes per search " << (numOfSearches ? (double)numOfTraversedNodes / numOfSearches : 0.0)
+            << ", find restarts " << numOfFindRestarts
+            << ", link retries " << numOfLinkRetries
+            << ", mark retries " << numOfMarkRetries << std::endl;
+        out << "CAS failures per level:";
+        for (unsigned int i = 0; i < maxNumOfLevels; ++i) {
+            if(casFailures[i] > 0) {
+                out << ' ' << i << ':' << casFailures[i];
+            }
+        }
+        out << std::endl;
+        out << "scans " << numOfScans
+            << ", retired per scan " << (numOfScans ? (double)numOfScannedRefs / numOfScans : 0.0)
+            << ", hazards per scan " << (numOfScans ? (double)numOfScannedHazards / numOfScans : 0.0)
+            << ", reclaimed " << numOfReclaimed
+            << ", mean reclamation latency " << (numOfReclaimed ? (double)reclamationNs / numOfReclaimed : 0.0) << " ns"
+            << ", max " << maxReclamationNs << " ns" << std::endl;
+    }
+};
+
+// Per-cell counters of the list operations
+struct OperationStats {
+    StatCounter numOfSearches;
+    StatCounter numOfTraversedNodes;
+    StatCounter numOfFindRestarts;
+    StatCounter numOfLinkRetries;
+    StatCounter numOfMarkRetries;
+    StatCounter casFailures[SkipListStats::maxNumOfLevels];
+
+    void collect(SkipListStats& stats) const {
+        stats.numOfSearches += numOfSearches.get();
+        stats.numOfTraversedNodes += numOfTraversedNodes.get();
+        stats.numOfFindRestarts += numOfFindRestarts.get();
+        stats.numOfLinkRetries += numOfLinkRetries.get();
+        stats.numOfMarkRetries += numOfMarkRetries.get();
+        for (unsigned int i = 0; i < SkipListStats::maxNumOfLevels; ++i) {
+            stats.casFailures[i] += casFailures[i].get();
+        }
+    }
+};
+
+// Per-cell counters of a reclamation domain
+struct ReclamationStats {
+    StatCounter numOfScans;
+    StatCounter numOfScannedRefs;
+    StatCounter numOfScannedHazards;
+    StatCounter numOfReclaimed;
+    StatCounter reclamationNs;
+    StatCounter maxReclamationNs;
+
+    void reclaimed(unsigned long long retiredAt, unsigned long long now) {
+        numOfReclaimed.add();
+        reclamationNs.add(now - retiredAt);
+        maxReclamationNs.max(now - retiredAt);
+    }
+
+    void collect(SkipListStats& stats) const {
+        stats.numOfScans += numOfScans.get();
+        stats.numOfScannedRefs += numOfScannedRefs.get();
+        stats.numOfScannedHazards += numOfScannedHazards.get();
+        stats.numOfReclaimed += numOfReclaimed.get();
+        stats.reclamationNs += reclamationNs.get();
+        stats.maxReclamationNs = maxReclamationNs.get() > stats.maxReclamationNs ? maxReclamationNs.get() : stats.maxReclamationNs;
+    }
+};
+
+#endif //SKIPLIST_STATS
+
+#endif //SKIPLIST_STATS_H
@@ -0,0 +1,199 @@
+#ifndef SNAPSHOT_FILE_H
+#define SNAPSHOT_FILE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Snapshot file: a header and count fixed-size records in key order, each record the raw
+// bytes of a key followed by those of its mapped value (maps only) and of the time it had
+// left (lists with a Clock only). Being raw bytes, a snapshot can only be read back by a build
+// with the same key, value and clock types and byte order.
+struct SnapshotHeader {
+    static const uint64_t magicNumber = 0x3150414e534c4b53ULL;    // "SKLSNAP1" on disk
+    // version 1 had no expiry bytes and 0 in their place
+    static const uint32_t currentVersion = 2;
+    static const uint32_t oldestVersion = 1;
+
+    uint64_t magic;
+    uint32_t version;
+    uint32_t keySize;
+    uint32_t mappedSize;
+    uint32_t expirySize;
+    uint64_t count;
+    // FNV-1a over the records, a 64-bit word at a time within each record
+    uint64_t checksum;
+};
+
+class SnapshotChecksum {
+    static const uint64_t prime = 0x100000001b3ULL;
+
+    uint64_t hash;
+
+public:
+    SnapshotChecksum() {
+        hash = 0xcbf29ce484222325ULL;
+    }
+
+    void add(const char* bytes, std::size_t size) {
+        std::size_t i = 0;
+        for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+            uint64_t word;
+            std::memcpy(&word, bytes + i, sizeof(uint64_t));
+            hash = (hash ^ word) * prime;
+        }
+        for (; i < size; ++i) {
+            hash = (hash ^ (unsigned char)bytes[i]) * prime;
+        }
+    }
+
+    uint64_t value() const {
+        return hash;
+    }
+};
+
+// Streams records into path.tmp and renames it to path once it is complete and synced, so a
+// crash while saving leaves the previous snapshot in place
+class SnapshotWriter {
+    static const std::size_t bufferSize = 1 << 20;
+
+    std::string path;
+    std::string tmpPath;
+    FILE* file;
+    std::vector<char> buffer;
+    SnapshotHeader header;
+    SnapshotChecksum checksum;
+    bool isFailed;
+
+public:
+    SnapshotWriter(const char* path, uint32_t keySize, uint32_t mappedSize, uint32_t expirySize)
+            : path(path), tmpPath(std::string(path) + ".tmp") {
+        header = SnapshotHeader();
+        header.magic = SnapshotHeader::magicNumber;
+        header.version = SnapshotHeader::currentVersion;
+        header.keySize = keySize;
+        header.mappedSize = mappedSize;
+        header.expirySize = expirySize;
+        file = std::fopen(tmpPath.c_str(), "wb");
+        isFailed = file == nullptr;
+        if(!isFailed) {
+            buffer.resize(bufferSize);
+            std::setvbuf(file, buffer.data(), _IOFBF, bufferSize);
+            // rewritten with the count and checksum by finish()
+            isFailed = std::fwrite(&header, sizeof(header), 1, file) != 1;
+        }
+    }
+
+    SnapshotWriter(const SnapshotWriter&) = delete;
+    SnapshotWriter& operator=(const SnapshotWriter&) = delete;
+
+    ~SnapshotWriter() {
+        if(file != nullptr) {
+            std::fclose(file);
+            std::remove(tmpPath.c_str());
+        }
+    }
+
+    void add(const char* record) {
+        if(isFailed) {
+            return;
+        }
+        std::size_t size = header.keySize + header.mappedSize + header.expirySize;
+        checksum.add(record, size);
+        ++header.count;
+        isFailed = std::fwrite(record, size, 1, file) != 1;
+    }
+
+    // Returns false if anything failed, the previous snapshot at path is kept then
+    bool finish() {
+        if(file == nullptr) {
+            return false;
+        }
+        header.checksum = checksum.value();
+        isFailed = isFailed || std::fseek(file, 0, SEEK_SET) != 0 || std::fwrite(&header, sizeof(header), 1, file) != 1;
+        isFailed = isFailed || std::fflush(file) != 0 || fsync(fileno(file)) != 0;
+        isFailed = std::fclose(file) != 0 || isFailed;
+        file = nullptr;
+        if(isFailed || std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+            std::remove(tmpPath.c_str());
+            return false;
+        }
+        return true;
+    }
+};
+
+// Maps a snapshot read-only and checks it against the expected record layout
+class SnapshotReader {
+    void* memory;
+    std::size_t size;
+    const SnapshotHeader* header;
+
+public:
+    SnapshotReader() {
+        memory = nullptr;
+        size = 0;
+        header = nullptr;
+    }
+
+    SnapshotReader(const SnapshotReader&) = delete;
+    SnapshotReader& operator=(const SnapshotReader&) = delete;
+
+    ~SnapshotReader() {
+        if(memory != nullptr) {
+            munmap(memory, size);
+        }
+    }
+
+    // Returns false if the file can't be mapped, isn't a snapshot of this layout or fails the
+    // checksum
+    bool open(const char* path, uint32_t keySize, uint32_t mappedSize, uint32_t expirySize) {
+        int fd = ::open(path, O_RDONLY);
+        if(fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if(fstat(fd, &st) != 0 || (std::size_t)st.st_size < sizeof(SnapshotHeader)) {
+            close(fd);
+            return false;
+        }
+        size = (std::size_t)st.st_size;
+        memory = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if(memory == MAP_FAILED) {
+            memory = nullptr;
+            return false;
+        }
+        // the records are read once front to back
+        madvise(memory, size, MADV_SEQUENTIAL);
+        header = (const SnapshotHeader*)memory;
+        std::size_t recordSize = keySize + mappedSize + expirySize;
+        if(header->magic != SnapshotHeader::magicNumber
+           || header->version < SnapshotHeader::oldestVersion || header->version > SnapshotHeader::currentVersion
+           || header->keySize != keySize || header->mappedSize != mappedSize || header->expirySize != expirySize
+           || (size - sizeof(SnapshotHeader)) / recordSize != header->count
+           || (size - sizeof(SnapshotHeader)) % recordSize != 0) {
+            return false;
+        }
+        SnapshotChecksum checksum;
+        for (uint64_t i = 0; i < header->count; ++i) {
+            checksum.add(records() + i * recordSize, recordSize);
+        }
+        return checksum.value() == header->checksum;
+    }
+
+    uint64_t count() const {
+        return header->count;
+    }
+
+    const char* records() const {
+        return (const char*)memory + sizeof(SnapshotHeader);
+    }
+};
+
+#endif //SNAPSHOT_FILE_H
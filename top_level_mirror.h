@@ -0,0 +1,135 @@
+#ifndef TOP_LEVEL_MIRROR_H
+#define TOP_LEVEL_MIRROR_H
+
+#include <atomic>
+#include "key_search.h"
+
+// Sorted copy of the keys and nodes of one upper level of a skip list, small enough to search
+// with a handful of vector compares, so a search can start right at that level instead of
+// chasing pointers through the sparse levels above it. One thread at a time rebuilds it.
+// The arrays are guarded like a seqlock: version is odd while a rebuild rewrites them, a
+// finished rebuild publishes the version it ends with, and removing a mirrored node adds 2
+// before the node is retired. A reader that protected a node and still sees the published
+// version afterwards knows the node wasn't retired by then.
+template <class T, class N> class TopLevelMirror {
+public:
+    static const unsigned int capacity = 256;
+
+private:
+    T keys[capacity];
+    N* nodes[capacity];
+    std::atomic<unsigned int> count{0};
+    std::atomic<unsigned int> level{1};
+    std::atomic<unsigned long long> version{0};
+    std::atomic<unsigned long long> publishedVersion{1};
+    // mirrored nodes added or removed since the last rebuild
+    std::atomic<unsigned int> numOfChanges{capacity};
+    std::atomic<bool> isRebuilding{false};
+
+    // touched only by the rebuilding thread
+    unsigned int maxLevel;
+    unsigned int nextLevel;
+    unsigned int numOfAdded;
+    unsigned long long rebuildVersion;
+
+public:
+    explicit TopLevelMirror(unsigned int maxLevel) {
+        this->maxLevel = maxLevel > 1 ? maxLevel : 1;
+        nextLevel = 1;
+        numOfAdded = 0;
+        rebuildVersion = 0;
+    }
+
+    // The last mirrored node with key < value and the mirrored level. Check isUnchanged()
+    // after protecting the node before using it.
+    bool find(const T& value, N*& node, unsigned int& lvl, unsigned long long& seenVersion) const {
+        seenVersion = version.load(std::memory_order_acquire);
+        if(seenVersion != publishedVersion.load(std::memory_order_relaxed)) {
+            return false;
+        }
+        unsigned int i = KeySearch<T>::countLess(keys, count.load(std::memory_order_relaxed), value);
+        if(i == 0) {
+            return false;
+        }
+        node = nodes[i-1];
+        lvl = level.load(std::memory_order_relaxed);
+        return true;
+    }
+
+    bool isUnchanged(unsigned long long seenVersion) const {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return version.load(std::memory_order_seq_cst) == seenVersion;
+    }
+
+    bool isStale() const {
+        return numOfChanges.load(std::memory_order_relaxed) > count.load(std::memory_order_relaxed) / 8;
+    }
+
+    // After a node with lvl upper levels has been linked
+    void inserted(unsigned int lvl) {
+        if(lvl >= level.load(std::memory_order_relaxed)) {
+            numOfChanges.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    // After a node with lvl upper levels has been marked and before it is retired. The fence
+    // pairs with the one in beginRebuild(): either the rebuild sees the node marked or this
+    // sees the level the rebuild mirrors.
+    void removed(unsigned int lvl) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(lvl >= level.load(std::memory_order_relaxed)) {
+            version.fetch_add(2, std::memory_order_seq_cst);
+            numOfChanges.store(capacity, std::memory_order_relaxed);
+        }
+    }
+
+    // Returns false if another thread is rebuilding, otherwise the level to walk and add()
+    bool beginRebuild(unsigned int& lvl) {
+        if(isRebuilding.load(std::memory_order_relaxed) || isRebuilding.exchange(true, std::memory_order_acquire)) {
+            return false;
+        }
+        unsigned long long v = version.load(std::memory_order_relaxed);
+        while (!version.compare_exchange_weak(v, v + 1, std::memory_order_seq_cst)) {
+        }
+        rebuildVersion = v + 1;
+        level.store(nextLevel, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        numOfChanges.store(0, std::memory_order_relaxed);
+        numOfAdded = 0;
+        lvl = nextLevel;
+        return true;
+    }
+
+    // Returns false when the level has more nodes than fit, the next rebuild goes a level up
+    bool add(const T& key, N* node) {
+        if(numOfAdded == capacity) {
+            if(nextLevel < maxLevel) {
+                ++nextLevel;
+            }
+            return false;
+        }
+        keys[numOfAdded] = key;
+        nodes[numOfAdded] = node;
+        ++numOfAdded;
+        return true;
+    }
+
+    // isComplete is false if the walk gave up, nothing is published then
+    void endRebuild(bool isComplete) {
+        if(isComplete && numOfAdded < capacity / 4 && nextLevel > 1) {
+            --nextLevel;
+        }
+        count.store(isComplete ? numOfAdded : 0, std::memory_order_relaxed);
+        publishedVersion.store(rebuildVersion + 1, std::memory_order_relaxed);
+        // a mirrored node removed meanwhile may be in the arrays, publish nothing then
+        unsigned long long expected = rebuildVersion;
+        if(!isComplete || !version.compare_exchange_strong(expected, rebuildVersion + 1, std::memory_order_release)) {
+            count.store(0, std::memory_order_relaxed);
+            numOfChanges.store(capacity, std::memory_order_relaxed);
+            version.fetch_add(1, std::memory_order_release);
+        }
+        isRebuilding.store(false, std::memory_order_release);
+    }
+};
+
+#endif //TOP_LEVEL_MIRROR_H